@@ -0,0 +1,180 @@
+#include "covr-log.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "defs.h"
+
+namespace trooper {
+
+  bool CovrLogReader::Open(const char* path) {
+    Close();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      fprintf(stderr, "failed to open %s\n", path);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    map_size_ = st.st_size;
+    if (map_size_) {
+      void* p = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        fprintf(stderr, "failed to mmap %s\n", path);
+        close(fd);
+        map_size_ = 0;
+        return false;
+      }
+      map_ = static_cast<const uint8_t*>(p);
+      madvise(p, map_size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    rest_ = ByteSpan(map_, map_size_);
+    ok_ = true;
+    return true;
+  }
+
+  void CovrLogReader::Close() {
+    if (map_)
+      munmap(const_cast<uint8_t*>(map_), map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+    rest_ = {};
+  }
+
+  bool CovrLogReader::Next(CovrRun& run) {
+    if (rest_.empty())
+      return false;
+    // a malformed run poisons the rest of the log, there is no resync point
+    ok_ = false;
+    ByteSpan in = rest_;
+    if (in.size() < 4 || memcmp(in.data(), kCovrLogMagic, 4) != 0)
+      return false;
+    in = in.subspan(4);
+    uint64_t tag_len;
+    if (!GetVarint(in, run.pid) || !GetVarint(in, run.time) ||
+      !GetVarint(in, run.map_size) || !GetVarint(in, tag_len) ||
+      tag_len > in.size())
+      return false;
+    run.tag = AsStringView(in.first(tag_len));
+    in = in.subspan(tag_len);
+    run.sections.clear();
+    while (true) {
+      if (in.empty())
+        return false;
+      uint8_t kind = in[0];
+      in = in.subspan(1);
+      if (kind == kCovrEnd)
+        break;
+      uint64_t len;
+      if (!GetVarint(in, len) || len > in.size())
+        return false;
+      run.sections.emplace_back(kind, in.first(len));
+      in = in.subspan(len);
+    }
+    rest_ = in;
+    ok_ = true;
+    return true;
+  }
+
+  bool ForEachEdge(ByteSpan edges,
+    const std::function<void(uint32_t, uint8_t)>& callback) {
+    uint64_t count;
+    if (!GetVarint(edges, count))
+      return false;
+    uint64_t id = 0;
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t delta;
+      if (!GetVarint(edges, delta) || edges.empty())
+        return false;
+      id += delta;
+      uint8_t bucket = edges[0];
+      if (delta >= kMaxCovrMapSize || id >= kMaxCovrMapSize || bucket == 0 ||
+        bucket > kNumBuckets)
+        return false;
+      callback(static_cast<uint32_t>(id), bucket);
+      edges = edges.subspan(1);
+    }
+    return true;
+  }
+
+  bool ForEachValueFeature(ByteSpan values, size_t& num_bits,
+    const std::function<void(uint32_t)>& callback) {
+    uint64_t size, count;
+    if (!GetVarint(values, size) || !GetVarint(values, count))
+      return false;
+    num_bits = size;
+    uint64_t bit = 0;
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t delta;
+      if (!GetVarint(values, delta))
+        return false;
+      bit += delta;
+      if (bit >= num_bits)
+        return false;
+      callback(static_cast<uint32_t>(bit));
+    }
+    return true;
+  }
+
+  bool DecodeProfile(ByteSpan payload, CovrProfile& profile) {
+    uint64_t n;
+    if (!GetVarint(payload, profile.wall_us) || !GetVarint(payload, profile.cpu_us) ||
+      !GetVarint(payload, profile.peak_rss_kb) || !GetVarint(payload, n))
+      return false;
+    profile.histogram.fill(0);
+    for (uint64_t i = 0; i < n; i++) {
+      uint64_t count;
+      if (!GetVarint(payload, count))
+        return false;
+      // tolerate more buckets from a newer writer
+      if (i < profile.histogram.size())
+        profile.histogram[i] = count;
+    }
+    return true;
+  }
+
+  bool MergeRun(const CovrRun& run, ByteArray& dense) {
+    if (run.map_size > kMaxCovrMapSize)
+      return false;
+    if (dense.size() < run.map_size)
+      dense.resize(run.map_size, 0);
+    ByteSpan edges = run.Section(kCovrEdges);
+    if (edges.empty())
+      return true;
+    return ForEachEdge(edges, [&](uint32_t id, uint8_t bucket) {
+      if (id >= dense.size())
+        dense.resize(id + 1, 0);
+      dense[id] |= 1 << (bucket - 1);
+    });
+  }
+
+  bool MergeCovrLogs(std::span<const std::string> paths, ByteArray& dense) {
+    bool ok = true;
+    for (const auto& path : paths) {
+      CovrLogReader reader;
+      if (!reader.Open(path.c_str())) {
+        ok = false;
+        continue;
+      }
+      CovrRun run;
+      while (reader.Next(run))
+        ok = MergeRun(run, dense) && ok;
+      if (!reader.ok()) {
+        fprintf(stderr, "malformed coverage log %s\n", path.c_str());
+        ok = false;
+      }
+    }
+    return ok;
+  }
+
+}  // namespace trooper
@@ -0,0 +1,301 @@
+#ifndef THIRD_PARTY_TROOPER_COVR_LOG_H_
+#define THIRD_PARTY_TROOPER_COVR_LOG_H_
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "defs.h"
+
+// Streaming sparse coverage log.
+//
+// A log is a sequence of runs, appended one after another, so a log can be
+// extended by any number of processes (CovrLogWriter::Append() locks the
+// file) and scanned (or mmapped) offline:
+//
+//   run     := magic "TCV1" | varint pid | varint time | varint map_size
+//              | varint tag_len | tag | section* | u8 kEnd
+//   section := u8 kind | varint payload_len | payload
+//   edges   := varint count | (varint id_delta | u8 bucket)*
+//   profile := varint wall_us | varint cpu_us | varint peak_rss_kb
+//              | varint n | varint histogram[n]
+//   values  := varint num_bits | varint count | varint index_delta*
+//
+// `time` is the unix time of the run, `tag` names the input (may be empty).
+// Edge ids are ascending, each stored as the delta to the previous one.
+// Buckets are the usual log2 classes of the hit counter, 1..8, and a dense
+// map built from a log has bit (bucket - 1) set for every bucket seen.
+// The profile section holds the resources used by the run, and a histogram
+// of the hit counters: histogram[b - 1] is the number of ids in bucket b.
+// The value profile section lists the set bits of a fixed-size feature map
+// hashed from comparison operands (see covr-rt.h), ascending, as deltas.
+// Readers skip sections of unknown kind.
+
+namespace trooper {
+
+  constexpr char kCovrLogMagic[4] = { 'T', 'C', 'V', '1' };
+
+  enum CovrSection : uint8_t {
+    kCovrEnd = 0,
+    kCovrEdges = 1,
+    kCovrProfile = 2,
+    kCovrValueProfile = 3,
+  };
+
+  constexpr size_t kNumBuckets = 8;
+  // Largest map (and edge id bound) a reader accepts, as many ids as covr-rt
+  // can assign. Keeps a corrupt header from allocating a huge dense map.
+  constexpr size_t kMaxCovrMapSize = 1 << 26;
+
+  // Resource usage of one run, see the profile section.
+  struct CovrProfile {
+    uint64_t wall_us = 0;      // wall time
+    uint64_t cpu_us = 0;       // user + system CPU time of the process
+    uint64_t peak_rss_kb = 0;  // peak RSS of the process so far
+    std::array<uint64_t, kNumBuckets> histogram{};
+  };
+
+  // Maps a hit counter to its bucket, 0 for no hit.
+  inline uint8_t CounterToBucket(uint8_t counter) {
+    if (counter < 4)
+      return counter;
+    if (counter < 8) return 4;
+    if (counter < 16) return 5;
+    if (counter < 32) return 6;
+    if (counter < 128) return 7;
+    return 8;
+  }
+
+  inline void PutVarint(ByteArray& out, uint64_t x) {
+    while (x >= 0x80) {
+      out.push_back(static_cast<uint8_t>(x) | 0x80);
+      x >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(x));
+  }
+
+  // Reads a varint from `in` and advances it. Returns false on truncation.
+  inline bool GetVarint(ByteSpan& in, uint64_t& x) {
+    x = 0;
+    for (size_t i = 0; i < in.size() && i < 10; i++) {
+      x |= static_cast<uint64_t>(in[i] & 0x7f) << (7 * i);
+      if (!(in[i] & 0x80)) {
+        in = in.subspan(i + 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Builds runs in memory and appends them to a log file.
+  // Header-only, so that covr-rt can use it without linking anything.
+  class CovrLogWriter {
+  public:
+    void BeginRun(uint64_t pid, uint64_t time, uint64_t map_size,
+      std::string_view tag) {
+      buf_.insert(buf_.end(), kCovrLogMagic, kCovrLogMagic + 4);
+      PutVarint(buf_, pid);
+      PutVarint(buf_, time);
+      PutVarint(buf_, map_size);
+      PutVarint(buf_, tag.size());
+      buf_.insert(buf_.end(), tag.begin(), tag.end());
+    }
+
+    // A slice of the coverage map: counters[i] is the hit counter of guard
+    // id first_id + i.
+    struct CounterRange {
+      size_t first_id;
+      const uint8_t* counters;
+      size_t size;
+    };
+
+    // Adds an edges section for the non-zero entries of `counters`,
+    // where counters[i] is the hit counter of guard id i.
+    void AddEdges(const uint8_t* counters, size_t size) {
+      CounterRange range = { 0, counters, size };
+      AddEdges({ &range, 1 });
+    }
+
+    // Same, for a map made of slices, sorted by first_id and disjoint.
+    void AddEdges(std::span<const CounterRange> ranges) {
+      payload_.clear();
+      size_t count = 0;
+      for (const auto& range : ranges)
+        for (size_t i = 0; i < range.size; i++)
+          count += range.counters[i] != 0;
+      PutVarint(payload_, count);
+      size_t prev = 0;
+      for (const auto& range : ranges) {
+        const uint8_t* counters = range.counters;
+        for (size_t i = 0; i < range.size; i++) {
+          // skip zero words, most of the map is zero
+          if (i % 8 == 0 && i + 8 <= range.size) {
+            uint64_t word;
+            memcpy(&word, counters + i, 8);
+            if (!word) {
+              i += 7;
+              continue;
+            }
+          }
+          if (!counters[i])
+            continue;
+          PutVarint(payload_, range.first_id + i - prev);
+          payload_.push_back(CounterToBucket(counters[i]));
+          prev = range.first_id + i;
+        }
+      }
+      AddSection(kCovrEdges, payload_);
+    }
+
+    void AddProfile(const CovrProfile& profile) {
+      payload_.clear();
+      PutVarint(payload_, profile.wall_us);
+      PutVarint(payload_, profile.cpu_us);
+      PutVarint(payload_, profile.peak_rss_kb);
+      PutVarint(payload_, profile.histogram.size());
+      for (uint64_t count : profile.histogram)
+        PutVarint(payload_, count);
+      AddSection(kCovrProfile, payload_);
+    }
+
+    // Adds a value profile section for the set bits of `words`, a map of
+    // `num_bits` bits.
+    void AddValueProfile(const uint64_t* words, size_t num_bits) {
+      payload_.clear();
+      size_t count = 0;
+      for (size_t i = 0; i < num_bits / 64; i++)
+        count += __builtin_popcountll(words[i]);
+      PutVarint(payload_, num_bits);
+      PutVarint(payload_, count);
+      size_t prev = 0;
+      for (size_t i = 0; i < num_bits / 64; i++) {
+        for (uint64_t word = words[i]; word; word &= word - 1) {
+          size_t bit = i * 64 + __builtin_ctzll(word);
+          PutVarint(payload_, bit - prev);
+          prev = bit;
+        }
+      }
+      AddSection(kCovrValueProfile, payload_);
+    }
+
+    void AddSection(uint8_t kind, ByteSpan payload) {
+      buf_.push_back(kind);
+      PutVarint(buf_, payload.size());
+      buf_.insert(buf_.end(), payload.begin(), payload.end());
+    }
+
+    void EndRun() { buf_.push_back(kCovrEnd); }
+
+    // Appends all finished runs to `path` and clears the buffer. The runs
+    // are written under an exclusive flock, so concurrent appenders (that
+    // all use this function) never interleave within a run.
+    bool Append(const char* path) {
+      int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+      if (fd < 0) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return false;
+      }
+      bool ok = flock(fd, LOCK_EX) == 0;
+      for (size_t done = 0; ok && done < buf_.size();) {
+        ssize_t n = write(fd, buf_.data() + done, buf_.size() - done);
+        if (n < 0 && errno == EINTR)
+          continue;
+        ok = n > 0;
+        done += ok ? n : 0;
+      }
+      // closing the fd releases the lock
+      ok = (close(fd) == 0) && ok;
+      buf_.clear();
+      return ok;
+    }
+
+    ByteSpan data() const { return buf_; }
+
+  private:
+    ByteArray buf_;
+    ByteArray payload_;
+  };
+
+  // One run of a log, pointing into the reader's mapping.
+  struct CovrRun {
+    uint64_t pid = 0;
+    uint64_t time = 0;
+    uint64_t map_size = 0;
+    std::string_view tag;
+    std::vector<std::pair<uint8_t, ByteSpan>> sections;
+
+    // Returns the payload of the first section of `kind`, empty if none.
+    ByteSpan Section(uint8_t kind) const {
+      for (const auto& [k, payload] : sections)
+        if (k == kind)
+          return payload;
+      return {};
+    }
+  };
+
+  // Scans a log file through a read-only mapping.
+  //
+  // This class is thread-compatible.
+  class CovrLogReader {
+  public:
+    CovrLogReader() = default;
+    CovrLogReader(const CovrLogReader&) = delete;
+    CovrLogReader& operator=(const CovrLogReader&) = delete;
+    ~CovrLogReader() { Close(); }
+
+    // Maps `path`. Returns false if it can not be opened.
+    bool Open(const char* path);
+    void Close();
+
+    // Reads the next run into `run`. Returns false at the end of the log,
+    // or if the rest of the log is malformed (see ok()).
+    bool Next(CovrRun& run);
+
+    // false if a malformed run was found.
+    bool ok() const { return ok_; }
+
+  private:
+    const uint8_t* map_ = nullptr;
+    size_t map_size_ = 0;
+    ByteSpan rest_;
+    bool ok_ = true;
+  };
+
+  // Calls `callback(id, bucket)` for every record of an edges section.
+  // Returns false if the payload is malformed, i.e. truncated, or with a
+  // bucket outside 1..kNumBuckets or an id >= kMaxCovrMapSize; records
+  // before the bad one have been passed to `callback`.
+  bool ForEachEdge(ByteSpan edges,
+    const std::function<void(uint32_t, uint8_t)>& callback);
+
+  // Calls `callback(bit)` for every feature of a value profile section, and
+  // sets `num_bits` to the size of its map. Returns false if it is malformed.
+  bool ForEachValueFeature(ByteSpan values, size_t& num_bits,
+    const std::function<void(uint32_t)>& callback);
+
+  // Decodes a profile section. Returns false if it is malformed.
+  bool DecodeProfile(ByteSpan payload, CovrProfile& profile);
+
+  // ORs the buckets of `run` into `dense`, growing it as needed:
+  // dense[id] |= 1 << (bucket - 1). Returns false, leaving `dense` at most
+  // kMaxCovrMapSize bytes, if the run is malformed.
+  bool MergeRun(const CovrRun& run, ByteArray& dense);
+
+  // Merges every run of every log in `paths` into `dense`.
+  bool MergeCovrLogs(std::span<const std::string> paths, ByteArray& dense);
+
+}  // namespace trooper
+
+#endif  // THIRD_PARTY_TROOPER_COVR_LOG_H_
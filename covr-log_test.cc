@@ -0,0 +1,140 @@
+#include "./covr-log.h"
+#include "./defs.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace trooper {
+
+void Test() {
+    const std::string path = "covr-log_test.log";
+    std::remove(path.c_str());
+
+    // two runs of the same binary, 64 guards
+    ByteArray counters(64, 0);
+    counters[1] = 1;
+    counters[9] = 3;
+    counters[40] = 200;
+    CovrLogWriter writer;
+    writer.BeginRun(1, 0, counters.size(), "input-a");
+    writer.AddEdges(counters.data(), counters.size());
+    CovrProfile profile;
+    profile.wall_us = 1500;
+    profile.cpu_us = 1200;
+    profile.peak_rss_kb = 4096;
+    profile.histogram = { 1, 0, 1, 0, 0, 0, 0, 1 };
+    writer.AddProfile(profile);
+    uint64_t values[2] = { 1ull << 3, 1ull << 63 | 1 };
+    writer.AddValueProfile(values, 128);
+    writer.EndRun();
+    counters.assign(64, 0);
+    counters[9] = 5;
+    counters[63] = 2;
+    writer.BeginRun(2, 0, counters.size(), "input-b");
+    writer.AddEdges(counters.data(), counters.size());
+    writer.EndRun();
+    std::cout << "encoded " << writer.data().size() << " bytes for 2 runs" << std::endl;
+    writer.Append(path.c_str());
+
+    CovrLogReader reader;
+    reader.Open(path.c_str());
+    CovrRun run;
+    while (reader.Next(run)) {
+        std::cout << "run " << run.tag << ": ";
+        ForEachEdge(run.Section(kCovrEdges), [](uint32_t id, uint8_t bucket) {
+            std::cout << id << "/" << static_cast<int>(bucket) << " ";
+        });
+        CovrProfile profile;
+        if (DecodeProfile(run.Section(kCovrProfile), profile)) {
+            std::cout << "(wall " << profile.wall_us << "us, cpu " << profile.cpu_us
+                << "us, rss " << profile.peak_rss_kb << "kB, histogram";
+            for (auto count : profile.histogram)
+                std::cout << " " << count;
+            std::cout << ")";
+        }
+        size_t num_bits = 0;
+        ByteSpan value_profile = run.Section(kCovrValueProfile);
+        if (!value_profile.empty()) {
+            std::cout << " values:";
+            ForEachValueFeature(value_profile, num_bits, [](uint32_t bit) {
+                std::cout << " " << bit;
+            });
+            std::cout << " of " << num_bits;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << "reader ok: " << reader.ok() << std::endl;
+
+    // expect 1:1 9:4|8 40:128 63:2
+    ByteArray dense;
+    std::vector<std::string> paths = { path };
+    MergeCovrLogs(paths, dense);
+    std::cout << "merged dense map: ";
+    for (size_t i = 0; i < dense.size(); i++)
+        if (dense[i])
+            std::cout << i << ":" << static_cast<int>(dense[i]) << " ";
+    std::cout << std::endl;
+    std::remove(path.c_str());
+}
+
+// runs larger than a stdio buffer, appended by several processes at once
+void TestConcurrentAppend() {
+    const std::string path = "covr-log_test.concurrent.log";
+    std::remove(path.c_str());
+    constexpr int kNumProcs = 4, kNumRuns = 20;
+    for (int p = 0; p < kNumProcs; p++) {
+        if (fork() == 0) {
+            ByteArray counters(1 << 16, 1);
+            CovrLogWriter writer;
+            for (int i = 0; i < kNumRuns; i++) {
+                writer.BeginRun(p, 0, counters.size(), "");
+                writer.AddEdges(counters.data(), counters.size());
+                writer.EndRun();
+                writer.Append(path.c_str());
+            }
+            _exit(0);
+        }
+    }
+    while (wait(nullptr) > 0) {}
+    CovrLogReader reader;
+    reader.Open(path.c_str());
+    CovrRun run;
+    int num_runs = 0;
+    while (reader.Next(run))
+        num_runs++;
+    std::cout << "concurrent appends: " << num_runs << " of " << kNumProcs * kNumRuns
+        << " runs, reader ok: " << reader.ok() << std::endl;
+    std::remove(path.c_str());
+}
+
+// corrupt headers and records are rejected before they reach the map
+void TestMalformed() {
+    auto merge = [](uint64_t map_size, std::initializer_list<uint8_t> edges) {
+        CovrRun run;
+        run.map_size = map_size;
+        ByteArray payload(edges);
+        run.sections.push_back({ kCovrEdges, ByteSpan(payload.data(), payload.size()) });
+        ByteArray dense;
+        bool ok = MergeRun(run, dense);
+        std::cout << ok << "/" << dense.size() << " ";
+    };
+    std::cout << "malformed runs (ok/map size): ";
+    merge(16, { 1, 3, 2 });           // valid, id 3 in bucket 2
+    merge(1ull << 62, { 0 });         // huge map_size
+    merge(16, { 1, 3, 0 });           // bucket 0
+    merge(16, { 1, 3, 9 });           // bucket > kNumBuckets
+    merge(16, { 1, 0xff, 0xff, 0xff, 0xff, 0x0f, 1 });  // id 2^32 - 1
+    std::cout << std::endl;
+}
+
+} // namespace trooper
+
+int main() {
+    trooper::Test();
+    trooper::TestConcurrentAppend();
+    trooper::TestMalformed();
+    return 0;
+}
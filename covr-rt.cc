@@ -1,85 +1,466 @@
+#include <deque>
 #include <vector>
+#include <string>
 #include <cstdint>
 #include <cstdio> // use sprintf, avoid init of std::cout
+#include <cstring>
 #include <algorithm> // std::min
-#include <cstdlib> // for std::atexit
+#include <cstdlib> // for std::atexit, std::getenv
+#include <ctime>
+#include <dlfcn.h> // dladdr
+#include <sys/mman.h>
+#include <unistd.h> // getpid
+#include <sys/resource.h> // getrusage
 #include <sanitizer/coverage_interface.h>
 
+#include "covr-rt.h"
+#include "covr-log.h"
+
 // do not use -fsanitize-coverage while compiling this file (infinite recursive).
 #include <iostream>
 
 namespace trooper {
 
+// Segmented coverage map: every instrumented module (the main binary, each
+// DSO, dlopen'd plugins) gets one contiguous slice of guard ids, in load
+// order. Modules built with trace-pc-guard count in a fixed reserved
+// region, so modules loaded later never move the counters of earlier ones.
+// Modules built with inline-8bit-counters are counted by the compiler: their
+// counter arrays are used as their slice of the map as is, no callback.
 class TCovr {
 public:
-	// 初始化bitmap大小，此处每个元素代表一个字节
-	TCovr(size_t size) : size_(size) {
-		bitmap_.resize(size_, 0); 
+	// 最多支持的 guard 数量, 只保留虚拟地址空间, 用到时才分配物理页
+	static constexpr size_t kMaxGuards = 1 << 26;
+	// 每个 epoch 记录的剪枝 guard 数量上限, 超出时 NewEpoch 遍历全部 guard
+	static constexpr size_t kMaxPruned = 1 << 16;
+	// value profile 特征位图大小, 8 KiB
+	static constexpr size_t kValueProfileBits = 1 << 16;
+
+	// `prune_threshold` 为 0 时不剪枝
+	explicit TCovr(uint8_t prune_threshold) : prune_threshold_(prune_threshold) {
+		void* p = mmap(nullptr, kMaxGuards, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "covr-rt: failed to reserve coverage map\n");
+			__builtin_trap();
+		}
+		bitmap_ = static_cast<uint8_t*>(p);
+		StartProfile();
+	}
+
+	// 为一个模块的 guard 分配连续编号, 记录到模块表.
+	// Returns false if the map is full, the guards are then left disabled.
+	bool AddModule(uint32_t* start, uint32_t* stop) {
+		size_t n = stop - start;
+		if (size_ + n > kMaxGuards) {
+			fprintf(stderr, "covr-rt: coverage map full, %zu guards dropped\n", n);
+			return false;
+		}
+		Module& m = NewModule(start, n);
+		m.start = start;
+		m.stop = stop;
+		m.counters = bitmap_ + m.first_id;
+		for (uint32_t* x = start; x < stop; x++)
+			*x = size_++; // 唯一编号
+		return true;
+	}
+
+	// inline-8bit-counters: the compiler's counters are the module's slice,
+	// they only take ids, no room in bitmap_.
+	// Returns false if the counters were already registered.
+	bool AddInlineModule(uint8_t* start, uint8_t* stop) {
+		// the same module may run its init twice (as libFuzzer, skip it)
+		for (const auto& m : modules_)
+			if (m.counters == start)
+				return false;
+		Module& m = NewModule(start, stop - start);
+		m.counters = start;
+		size_ += m.size;
+		return true;
+	}
+
+	// pc-table: {pc, flags} per counter, for the module whose counters were
+	// just registered (clang calls *_init and pcs_init from the same ctor).
+	void AddPcs(const uintptr_t* beg, const uintptr_t* end) {
+		size_t n = (end - beg) / 2;
+		for (auto m = modules_.rbegin(); m != modules_.rend(); ++m)
+			if (!m->pcs && m->size == n) {
+				m->pcs = beg;
+				return;
+			}
+		fprintf(stderr, "covr-rt: pc table of %zu entries has no module\n", n);
+	}
+
+	// Returns the pc of guard `id` if its module has a pc table, else 0.
+	uintptr_t Pc(uint32_t id) const {
+		// modules_ is sorted by first_id
+		auto m = std::upper_bound(modules_.begin(), modules_.end(), id,
+			[](uint32_t id, const Module& m) { return id < m.first_id; });
+		if (m == modules_.begin())
+			return 0;
+		--m;
+		if (id >= m->first_id + m->size || !m->pcs)
+			return 0;
+		return m->pcs[2 * (id - m->first_id)];
 	}
 
 	// __attribute__((no_sanitize("coverage")))
 	void Hit(uint32_t* guard) {
 		uint32_t guard_id = *guard;
-		if (guard_id < size_)
-			if (++bitmap_[guard_id] == 255)
-				*guard = 0;
+		uint8_t counter = bitmap_[guard_id];
+		if (counter != 255)
+			bitmap_[guard_id] = ++counter;
+		// hot guard: disable the callback until the next epoch
+		if (counter == prune_threshold_) {
+			*guard = 0;
+			// remember it for NewEpoch(); if the list is full, it walks the map
+			size_t n = __atomic_fetch_add(&num_pruned_, 1, __ATOMIC_RELAXED);
+			if (n < kMaxPruned)
+				pruned_[n] = {guard, guard_id};
+		}
+	}
+
+	// value profile: one feature per (comparison pc, operand distance).
+	// 同一 pc 的 65 种距离落在不同的位上
+	void AddValueFeature(uintptr_t pc, uint32_t distance) {
+		uint64_t idx = ((pc * 0x9e3779b97f4a7c15ull) >> 32) * 65 + distance;
+		idx &= kValueProfileBits - 1;
+		value_bits_[idx / 64] |= 1ull << (idx % 64);
 	}
 
+	bool value_profile() const { return value_profile_; }
+	void set_value_profile(bool enable) {
+		if (enable && !value_profile_)
+			memset(value_bits_, 0, sizeof(value_bits_));
+		value_profile_ = enable;
+	}
+	const uint64_t* value_bits() const { return value_bits_; }
+
+	// Re-arms every pruned guard and resets the counters, so the next input
+	// sees all edges again. Call at the start of each input or epoch.
+	void NewEpoch() {
+		size_t num_pruned = __atomic_exchange_n(&num_pruned_, 0, __ATOMIC_RELAXED);
+		if (num_pruned <= kMaxPruned) {
+			for (size_t i = 0; i < num_pruned; i++)
+				*pruned_[i].guard = pruned_[i].id;
+		} else {
+			for (const auto& m : modules_)
+				for (uint32_t* x = m.start; x < m.stop; x++)
+					if (!*x)
+						*x = m.first_id + (x - m.start);
+		}
+		Reset();
+		if (value_profile_)
+			memset(value_bits_, 0, sizeof(value_bits_));
+		StartProfile();
+	}
+
+	// Writes up to `max` ids of currently pruned guards into `ids`,
+	// returns the total number of pruned guards.
+	size_t Pruned(uint32_t* ids, size_t max) const {
+		size_t n = 0;
+		for (const auto& m : modules_)
+			for (uint32_t* x = m.start; x < m.stop; x++)
+				if (!*x) {
+					if (n < max)
+						ids[n] = m.first_id + (x - m.start);
+					n++;
+				}
+		return n;
+	}
+
+	// Writes up to `max` module descriptions into `out`,
+	// returns the number of modules.
+	size_t Modules(trooper_covr_module* out, size_t max) const {
+		for (size_t i = 0; i < modules_.size() && i < max; i++) {
+			const Module& m = modules_[i];
+			out[i] = {m.name.c_str(), m.base, m.first_id, m.size, m.counters, m.pcs};
+		}
+		return modules_.size();
+	}
+
+	void set_prune_threshold(uint8_t threshold) { prune_threshold_ = threshold; }
+
 	void Reset() {
-		std::fill(bitmap_.begin(), bitmap_.end(), 0);
+		for (const auto& m : modules_)
+			memset(m.counters, 0, m.size);
+	}
+
+	// Resources used since the start of the epoch (or of the process), and
+	// the histogram of the counters. Only system calls, nothing on the hot path.
+	CovrProfile Profile() const {
+		CovrProfile profile;
+		profile.wall_us = (NowUs(CLOCK_MONOTONIC) - wall_start_us_);
+		profile.cpu_us = (NowUs(CLOCK_PROCESS_CPUTIME_ID) - cpu_start_us_);
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0)
+			profile.peak_rss_kb = usage.ru_maxrss;
+		for (const auto& m : modules_)
+			for (uint32_t i = 0; i < m.size; i++)
+				if (m.counters[i])
+					profile.histogram[CounterToBucket(m.counters[i]) - 1]++;
+		return profile;
+	}
+
+	// appends the current counters and profile as one run of a sparse
+	// coverage log, see covr-log.h
+	void Write(const char* fn, const char* tag) {
+		ranges_.clear();
+		for (const auto& m : modules_)
+			ranges_.push_back({m.first_id, m.counters, m.size});
+		log_.BeginRun(getpid(), time(nullptr), size_, tag ? tag : "");
+		log_.AddEdges(ranges_);
+		log_.AddProfile(Profile());
+		if (value_profile_)
+			log_.AddValueProfile(value_bits_, kValueProfileBits);
+		log_.EndRun();
+		log_.Append(fn);
+	}
+
+	// module table, one line per module: first_id size base name
+	void WriteModules(const char* fn) {
+		FILE* f = fopen(fn, "w");
+		if (!f) {
+			fprintf(stderr, "failed to open %s\n", fn);
+			return;
+		}
+		for (const auto& m : modules_)
+			fprintf(f, "%u %u 0x%zx %s\n", m.first_id, m.size, size_t(m.base),
+				m.name.c_str());
+		fclose(f);
 	}
 
-	void Write(const char* fn) {
-		FILE* f = fopen(fn, "wb");
+	// pc table, one line per id of modules that have one: id module_offset
+	void WritePcs(const char* fn) {
+		if (std::none_of(modules_.begin(), modules_.end(),
+			[](const Module& m) { return m.pcs; }))
+			return;
+		FILE* f = fopen(fn, "w");
 		if (!f) {
 			fprintf(stderr, "failed to open %s\n", fn);
 			return;
 		}
-		fwrite(bitmap_.data(), 1, bitmap_.size(), f);
+		for (const auto& m : modules_)
+			for (uint32_t i = 0; m.pcs && i < m.size; i++)
+				fprintf(f, "%u 0x%zx\n", m.first_id + i, size_t(m.pcs[2 * i] - m.base));
 		fclose(f);
 	}
 
 private:
-	std::vector<uint8_t> bitmap_; // 存储覆盖信息的bitmap, 每个 guard 占一字节
-	size_t size_; // 总 guard 数量
+	struct Module {
+		std::string name; // path of the binary or DSO
+		uintptr_t base = 0; // load address
+		uint32_t* start = nullptr; // guards of this module, null if inline counters
+		uint32_t* stop = nullptr;
+		uint32_t first_id = 0; // id of the first counter
+		uint32_t size = 0;
+		uint8_t* counters = nullptr; // slice of bitmap_, or compiler counters
+		const uintptr_t* pcs = nullptr; // pc table, {pc, flags} per counter
+	};
+
+	static uint64_t NowUs(clockid_t clock) {
+		struct timespec ts;
+		clock_gettime(clock, &ts);
+		return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+	}
+
+	void StartProfile() {
+		wall_start_us_ = NowUs(CLOCK_MONOTONIC);
+		cpu_start_us_ = NowUs(CLOCK_PROCESS_CPUTIME_ID);
+	}
+
+	// appends a module of `n` ids, starting at the next free id
+	Module& NewModule(const void* addr, size_t n) {
+		Module m;
+		Dl_info info;
+		if (dladdr(addr, &info)) {
+			if (info.dli_fname)
+				m.name = info.dli_fname;
+			m.base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+		}
+		m.first_id = size_;
+		m.size = n;
+		modules_.push_back(std::move(m));
+		return modules_.back();
+	}
+
+	uint8_t* bitmap_; // 存储覆盖信息的bitmap, 每个 guard 占一字节 (trace-pc-guard)
+	// 模块表, 按加载顺序. deque: elements never move, so names handed out by
+	// Modules() stay valid when later modules are added
+	std::deque<Module> modules_;
+	CovrLogWriter log_; // reused output buffer
+	std::vector<CovrLogWriter::CounterRange> ranges_;
+	size_t size_ = 1; // 已分配的 id 数量, id 0 表示 guard 已禁用
+	uint8_t prune_threshold_; // 计数达到该值时剪枝
+	uint64_t wall_start_us_ = 0; // start of the epoch
+	uint64_t cpu_start_us_ = 0;
+	struct PrunedGuard {
+		uint32_t* guard;
+		uint32_t id;
+	};
+	PrunedGuard pruned_[kMaxPruned]; // guards pruned in this epoch
+	size_t num_pruned_ = 0;
+	bool value_profile_ = false;
+	uint64_t value_bits_[kValueProfileBits / 64] = {};
 };
 
 } // namespace trooper
 
 // global coverage
 static trooper::TCovr* covr = nullptr;
+static bool verbose = false;
+static bool exit_dump = true;
+
+// TROOPER_COVR_LOG: coverage log to append runs to
+static const char* LogPath() {
+	const char* path = std::getenv("TROOPER_COVR_LOG");
+	return path ? path : "coverage.log";
+}
 
 // register callbck at exit
 static void WriteCovAtExit(void) {
-	if (covr) {
-		covr->Write("coverage.cov");
+	if (covr && exit_dump) {
+		// TROOPER_COVR_TAG: names the input of this run
+		covr->Write(LogPath(), std::getenv("TROOPER_COVR_TAG"));
+		covr->WriteModules("coverage.modules");
+		covr->WritePcs("coverage.pcs");
 		covr->Reset();
 	}
 }
 
+static void InitCovr() {
+	if (covr)
+		return;
+	// TROOPER_COVR_VERBOSE=1: log module registration to stderr
+	if (const char* env = std::getenv("TROOPER_COVR_VERBOSE"))
+		verbose = atoi(env) != 0;
+	// TROOPER_PRUNE_THRESHOLD: 0 disables pruning, default 255
+	uint8_t threshold = 255;
+	if (const char* env = std::getenv("TROOPER_PRUNE_THRESHOLD"))
+		threshold = std::min(atoi(env), 255);
+	covr = new trooper::TCovr(threshold);
+	// TROOPER_VALUE_PROFILE=1: features from trace-cmp operands
+	if (const char* env = std::getenv("TROOPER_VALUE_PROFILE"))
+		covr->set_value_profile(atoi(env) != 0);
+	std::atexit(WriteCovAtExit);
+}
+
+// called once per instrumented module, including dlopen'd ones
 extern "C" void __sanitizer_cov_trace_pc_guard_init(uint32_t * start, uint32_t * stop) {
-	static uint64_t N = 0; 
 	if (start == stop || *start) // 如果已初始化，直接返回
 		return;
+	InitCovr();
+	if (covr->AddModule(start, stop) && verbose)
+		fprintf(stderr, "covr-rt: new module, %zu guards\n", size_t(stop - start));
+}
 
-	if (!covr) {
-		covr = new trooper::TCovr(stop - start);
-		std::atexit(WriteCovAtExit);
-	}
-
-	for (uint32_t* x = start; x < stop; x++)
-		*x = ++N; // 唯一编号
+// -fsanitize-coverage=inline-8bit-counters, once per module
+extern "C" void __sanitizer_cov_8bit_counters_init(uint8_t* start, uint8_t* stop) {
+	if (start == stop)
+		return;
+	InitCovr();
+	if (covr->AddInlineModule(start, stop) && verbose)
+		fprintf(stderr, "covr-rt: new module, %zu inline counters\n", size_t(stop - start));
+}
 
-	// test
-	printf("hit new dso!\n");
+// -fsanitize-coverage=pc-table, right after the counters/guards init
+extern "C" void __sanitizer_cov_pcs_init(const uintptr_t* pcs_beg, const uintptr_t* pcs_end) {
+	if (covr)
+		covr->AddPcs(pcs_beg, pcs_end);
 }
 
 extern "C" void __sanitizer_cov_trace_pc_guard(uint32_t * guard) {
 	// maybe this guard is hotspot, skip it
 	if (!*guard) return;
 	if (covr) {
-		covr->Hit(guard); 
+		covr->Hit(guard);
 	}
-	// test
-	printf("hit new edge at %d!\n", *guard);
+}
+
+// -fsanitize-coverage=trace-cmp. 关闭时只多一次分支
+template <typename T>
+static inline void TraceCmp(void* pc, T a, T b) {
+	if (covr && covr->value_profile())
+		covr->AddValueFeature(reinterpret_cast<uintptr_t>(pc),
+			__builtin_popcountll(static_cast<uint64_t>(a ^ b)));
+}
+
+extern "C" void __sanitizer_cov_trace_cmp1(uint8_t a, uint8_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+extern "C" void __sanitizer_cov_trace_cmp2(uint16_t a, uint16_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+extern "C" void __sanitizer_cov_trace_cmp4(uint32_t a, uint32_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+extern "C" void __sanitizer_cov_trace_cmp8(uint64_t a, uint64_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+extern "C" void __sanitizer_cov_trace_const_cmp1(uint8_t a, uint8_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+extern "C" void __sanitizer_cov_trace_const_cmp2(uint16_t a, uint16_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+extern "C" void __sanitizer_cov_trace_const_cmp4(uint32_t a, uint32_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+extern "C" void __sanitizer_cov_trace_const_cmp8(uint64_t a, uint64_t b) {
+	TraceCmp(__builtin_return_address(0), a, b);
+}
+
+// cases[0] 为 case 数量, cases[1] 为位宽, 之后为各 case 的值;
+// 只记录离 `val` 最近的 case
+extern "C" void __sanitizer_cov_trace_switch(uint64_t val, uint64_t* cases) {
+	if (!covr || !covr->value_profile() || !cases[0])
+		return;
+	uint32_t distance = 64;
+	for (uint64_t i = 0; i < cases[0]; i++)
+		distance = std::min(distance, uint32_t(__builtin_popcountll(val ^ cases[2 + i])));
+	covr->AddValueFeature(reinterpret_cast<uintptr_t>(__builtin_return_address(0)),
+		distance);
+}
+
+extern "C" void trooper_covr_new_epoch(void) {
+	if (covr)
+		covr->NewEpoch();
+}
+
+extern "C" void trooper_covr_set_prune_threshold(uint8_t threshold) {
+	if (covr)
+		covr->set_prune_threshold(threshold);
+}
+
+extern "C" size_t trooper_covr_pruned(uint32_t* ids, size_t max) {
+	return covr ? covr->Pruned(ids, max) : 0;
+}
+
+extern "C" size_t trooper_covr_modules(trooper_covr_module* out, size_t max) {
+	return covr ? covr->Modules(out, max) : 0;
+}
+
+extern "C" void trooper_covr_set_exit_dump(int enable) {
+	exit_dump = enable != 0;
+}
+
+extern "C" void trooper_covr_append_run(const char* tag) {
+	if (covr)
+		covr->Write(LogPath(), tag);
+}
+
+extern "C" uintptr_t trooper_covr_pc(uint32_t id) {
+	return covr ? covr->Pc(id) : 0;
+}
+
+extern "C" void trooper_covr_set_value_profile(int enable) {
+	if (covr)
+		covr->set_value_profile(enable != 0);
+}
+
+extern "C" const uint64_t* trooper_covr_value_profile(size_t* num_bits) {
+	if (!covr || !covr->value_profile())
+		return nullptr;
+	*num_bits = trooper::TCovr::kValueProfileBits;
+	return covr->value_bits();
 }
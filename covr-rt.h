@@ -0,0 +1,78 @@
+#ifndef THIRD_PARTY_TROOPER_COVR_RT_H_
+#define THIRD_PARTY_TROOPER_COVR_RT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Control interface of covr-rt, the sanitizer-coverage runtime. Supports
+// -fsanitize-coverage=trace-pc-guard and inline-8bit-counters, each with
+// an optional pc-table.
+// All functions are no-ops before the first module is instrumented.
+extern "C" {
+
+  // Starts a new epoch (e.g. a new input): re-arms all guards pruned as hot,
+  // resets the coverage counters and restarts the profile clocks.
+  void trooper_covr_new_epoch(void);
+
+  // Guards are pruned (their callback disabled until the next epoch) once
+  // their counter reaches `threshold`. 0 disables pruning.
+  // Default is 255, or the value of env TROOPER_PRUNE_THRESHOLD.
+  void trooper_covr_set_prune_threshold(uint8_t threshold);
+
+  // Writes up to `max` ids of currently pruned guards into `ids`.
+  // Returns the total number of pruned guards, which may exceed `max`.
+  size_t trooper_covr_pruned(uint32_t* ids, size_t max);
+
+  // One slice of the coverage map: the guards (or inline 8-bit counters) of
+  // one instrumented module (main binary, DSO or dlopen'd plugin) have ids
+  // [first_id, first_id + size). Slices never move once assigned.
+  struct trooper_covr_module {
+    const char* name;  // path of the module, "" if unknown
+    uintptr_t base;    // load address of the module
+    uint32_t first_id;
+    uint32_t size;
+    // counters[i] is the hit counter of id first_id + i; for
+    // inline-8bit-counters modules, the compiler's own array.
+    const uint8_t* counters;
+    // -fsanitize-coverage=pc-table: {pc, flags} per counter, else null.
+    const uintptr_t* pcs;
+  };
+
+  // Writes up to `max` modules into `out`, in load order.
+  // Returns the total number of modules. All pointers in `out` stay valid
+  // for the lifetime of the process, modules are never removed.
+  size_t trooper_covr_modules(trooper_covr_module* out, size_t max);
+
+  // Appends the current counters as one run named `tag` (may be null) to
+  // the coverage log, env TROOPER_COVR_LOG or "coverage.log", with the
+  // profile of the epoch: wall and CPU time, peak RSS and a histogram of
+  // the hit counters.
+  // A run is also appended at exit, tagged with env TROOPER_COVR_TAG.
+  // See covr-log.h for the format.
+  void trooper_covr_append_run(const char* tag);
+
+  // Enables (the default) or disables the run appended at exit, and the
+  // coverage.modules / coverage.pcs files written with it. In-process
+  // drivers that read the counters themselves turn it off.
+  void trooper_covr_set_exit_dump(int enable);
+
+  // Returns the pc of the edge with id `id`, or 0 if its module was not
+  // built with -fsanitize-coverage=pc-table.
+  // Pc tables are also written to coverage.pcs at exit, as module offsets.
+  uintptr_t trooper_covr_pc(uint32_t id);
+
+  // Value profile, for modules built with -fsanitize-coverage=trace-cmp:
+  // every comparison sets one bit of a fixed-size map, hashed from its pc
+  // and the Hamming distance of its operands, so inputs that get closer to
+  // a magic value show up as new features. Off by default, or enabled by
+  // env TROOPER_VALUE_PROFILE=1. The map is cleared by each new epoch and
+  // written beside the edges of each run in the coverage log.
+  void trooper_covr_set_value_profile(int enable);
+
+  // Returns the value profile map of the current epoch, *num_bits bits
+  // (a power of 2) as 64-bit words, or null if the value profile is off.
+  const uint64_t* trooper_covr_value_profile(size_t* num_bits);
+
+}
+
+#endif  // THIRD_PARTY_TROOPER_COVR_RT_H_
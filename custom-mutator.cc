@@ -0,0 +1,195 @@
+/*
+ libFuzzer / AFL++ custom mutator built from libmutator, runs Trooper's
+ knob-weighted mutators in-process.
+
+ libFuzzer: link the target with this library, LLVMFuzzerCustomMutator and
+   LLVMFuzzerCustomCrossOver are picked up automatically.
+ AFL++: `AFL_CUSTOM_MUTATOR_LIBRARY=libcustom_mutator.so`.
+
+ Every thread (libFuzzer) or afl_custom_init instance (AFL++) owns its own
+ Mutator and Knobs. Knob values come through a side channel, shared by all
+ of them:
+ - `TROOPER_KNOBS=<file>`: raw knob values, one byte per knob in knob id
+   order (see docs/knobs.md). The file is re-read whenever its mtime
+   changes, checked every kPollInterval mutations.
+ - `trooper_set_knobs()`: for fuzzers that tune knobs in-process.
+ `TROOPER_DEDUP=<log2 bits>` (e.g. 24, 2 MiB) makes all mutators share one
+ DedupFilter, so mutants identical to earlier ones are mutated further.
+*/
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "dedup.h"
+#include "defs.h"
+#include "knobs.h"
+#include "mutator.h"
+
+namespace trooper {
+namespace {
+
+  constexpr uint64_t kPollInterval = 4096;
+
+  // Latest knob values, published to all mutators through `generation`.
+  class KnobChannel {
+  public:
+    void Publish(const uint8_t* values, size_t size) {
+      std::lock_guard<std::mutex> lock(mu_);
+      size = std::min(size, Knobs::kNumKnobs);
+      memcpy(values_.data(), values, size);
+      size_ = size;
+      generation_.fetch_add(1, std::memory_order_release);
+    }
+
+    // Copies the latest values into `knobs` if they changed since
+    // `generation`, which is then updated.
+    void Update(Knobs& knobs, uint64_t& generation) {
+      if (generation_.load(std::memory_order_acquire) == generation)
+        return;
+      std::lock_guard<std::mutex> lock(mu_);
+      knobs.Set(std::span<const uint8_t>(values_.data(), size_));
+      generation = generation_.load(std::memory_order_relaxed);
+    }
+
+    // Re-reads the TROOPER_KNOBS file if it was modified.
+    void Poll() {
+      const char* path = getenv("TROOPER_KNOBS");
+      struct stat st;
+      if (!path || stat(path, &st) != 0)
+        return;
+      int64_t mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+      if (mtime == mtime_.exchange(mtime))
+        return;
+      FILE* f = fopen(path, "rb");
+      if (!f) {
+        fprintf(stderr, "custom-mutator: failed to open %s\n", path);
+        return;
+      }
+      uint8_t values[Knobs::kNumKnobs];
+      size_t size = fread(values, 1, sizeof(values), f);
+      fclose(f);
+      Publish(values, size);
+    }
+
+  private:
+    std::mutex mu_;
+    std::array<uint8_t, Knobs::kNumKnobs> values_{};
+    size_t size_ = 0;
+    std::atomic<uint64_t> generation_{ 0 };
+    std::atomic<int64_t> mtime_{ 0 };
+  };
+
+  KnobChannel knob_channel;
+
+  // The filter shared by all mutators, null unless TROOPER_DEDUP is set.
+  DedupFilter* SharedDedupFilter() {
+    static std::unique_ptr<DedupFilter> filter = []() {
+      const char* env = getenv("TROOPER_DEDUP");
+      size_t log2_bits = env ? strtoul(env, nullptr, 10) : 0;
+      if (!log2_bits)
+        return std::unique_ptr<DedupFilter>();
+      return std::make_unique<DedupFilter>(std::clamp<size_t>(log2_bits, 9, 40));
+    }();
+    return filter.get();
+  }
+
+  // Mutator state of one thread or one AFL++ instance.
+  struct State {
+    explicit State(uint64_t seed) : mutator(seed ? seed : 1, knobs) {
+      mutator.set_dedup_filter(SharedDedupFilter());
+    }
+
+    // Syncs knobs with the side channel, polling the file now and then.
+    void Sync() {
+      if (++calls % kPollInterval == 1)
+        knob_channel.Poll();
+      knob_channel.Update(knobs, generation);
+    }
+
+    Knobs knobs;
+    Mutator mutator;
+    ByteArray buf;  // AFL++ output buffer, keeps its capacity across calls
+    uint64_t generation = 0;
+    uint64_t calls = 0;
+  };
+
+  State& ThreadState(unsigned int seed) {
+    thread_local State state(seed);
+    return state;
+  }
+
+}  // namespace
+}  // namespace trooper
+
+using trooper::ByteSpan;
+using trooper::State;
+
+extern "C" void trooper_set_knobs(const uint8_t* values, size_t size) {
+  trooper::knob_channel.Publish(values, size);
+}
+
+// libFuzzer. `seed` only seeds the thread's Mutator on its first call.
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t* data, size_t size,
+  size_t max_size, unsigned int seed) {
+  State& state = trooper::ThreadState(seed);
+  state.Sync();
+  state.mutator.set_max_len(max_size);
+  // in place in libFuzzer's buffer, which holds up to max_size bytes
+  size_t new_size = state.mutator.Mutate(data, size, max_size);
+  return new_size ? new_size : size;
+}
+
+extern "C" size_t LLVMFuzzerCustomCrossOver(const uint8_t* data1, size_t size1,
+  const uint8_t* data2, size_t size2, uint8_t* out, size_t max_out_size,
+  unsigned int seed) {
+  State& state = trooper::ThreadState(seed);
+  state.Sync();
+  state.mutator.set_max_len(max_out_size);
+  size_t size = std::min(size1, max_out_size);
+  memcpy(out, data1, size);
+  size_t new_size = state.mutator.CrossOver(out, size, max_out_size,
+    ByteSpan(data2, size2));
+  return new_size ? new_size : size;
+}
+
+// AFL++
+extern "C" void* afl_custom_init(void* afl, unsigned int seed) {
+  (void)afl;
+  return new State(seed);
+}
+
+extern "C" size_t afl_custom_fuzz(void* data, uint8_t* buf, size_t buf_size,
+  uint8_t** out_buf, uint8_t* add_buf, size_t add_buf_size, size_t max_size) {
+  State& state = *static_cast<State*>(data);
+  state.Sync();
+  state.mutator.set_max_len(max_size);
+  // AFL++ owns `buf` and can not grow it, mutate in our own buffer, which
+  // only reallocates when max_size grows
+  if (state.buf.size() < max_size)
+    state.buf.resize(max_size);
+  size_t size = std::min(buf_size, max_size);
+  memcpy(state.buf.data(), buf, size);
+  size_t new_size;
+  // splice with the second input now and then
+  if (add_buf && add_buf_size && state.mutator.rng()() % 2)
+    new_size = state.mutator.CrossOver(state.buf.data(), size, max_size,
+      ByteSpan(add_buf, add_buf_size));
+  else
+    new_size = state.mutator.Mutate(state.buf.data(), size, max_size);
+  *out_buf = state.buf.data();
+  return new_size ? new_size : size;
+}
+
+extern "C" void afl_custom_deinit(void* data) {
+  delete static_cast<State*>(data);
+}
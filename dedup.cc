@@ -0,0 +1,96 @@
+#include "dedup.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "defs.h"
+
+namespace trooper {
+
+  namespace {
+
+    constexpr uint64_t kMul1 = 0x9e3779b97f4a7c15ULL;
+    constexpr uint64_t kMul2 = 0xbf58476d1ce4e5b9ULL;
+
+    uint64_t Mix(uint64_t x) {
+      x ^= x >> 31;
+      x *= kMul2;
+      x ^= x >> 29;
+      return x;
+    }
+
+  }  // namespace
+
+  uint64_t HashBytes(ByteSpan bytes) {
+    const uint8_t* p = bytes.data();
+    size_t n = bytes.size();
+    // the lanes have no dependency on each other within a round
+    uint64_t lanes[4] = { kMul1, kMul2, kMul1 ^ n, kMul2 ^ n };
+    for (; n >= 32; n -= 32, p += 32) {
+      for (size_t i = 0; i < 4; i++) {
+        uint64_t word;
+        memcpy(&word, p + 8 * i, 8);
+        lanes[i] = (lanes[i] ^ word) * kMul1;
+        lanes[i] ^= lanes[i] >> 32;
+      }
+    }
+    // the tail, zero padded; its length is part of the seed of lanes 2-3
+    uint8_t tail[32] = {};
+    memcpy(tail, p, n);
+    for (size_t i = 0; i < 4; i++) {
+      uint64_t word;
+      memcpy(&word, tail + 8 * i, 8);
+      lanes[i] = (lanes[i] ^ word) * kMul1;
+    }
+    return Mix(Mix(lanes[0]) + lanes[1] * kMul2) ^
+      Mix(Mix(lanes[2]) + lanes[3] * kMul2);
+  }
+
+  DedupFilter::DedupFilter(size_t log2_bits) {
+    if (log2_bits < 9 || log2_bits > 40)
+      __builtin_trap();
+    num_blocks_ = size_t{ 1 } << (log2_bits - 9);
+    blocks_.reset(new Block[num_blocks_]);
+    Clear();
+  }
+
+  bool DedupFilter::Insert(uint64_t hash) {
+    Block& block = BlockOf(hash);
+    uint64_t is_new = 0;
+    for (size_t i = 0; i < kWordsPerBlock; i++) {
+      uint64_t mask = Mask(hash, i);
+      // skip the RMW (and the cache line bouncing) if the bit is set
+      if (block.words[i].load(std::memory_order_relaxed) & mask)
+        continue;
+      is_new |= ~block.words[i].fetch_or(mask, std::memory_order_relaxed) & mask;
+    }
+    if (!is_new)
+      return false;
+    // exactly one thread sees the count reach the limit; hashes inserted
+    // by others while it clears may be lost, and reported new again later
+    if (num_inserted_.fetch_add(1, std::memory_order_relaxed) + 1 == max_inserted()) {
+      Clear();
+      num_clears_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  bool DedupFilter::Contains(uint64_t hash) const {
+    const Block& block = BlockOf(hash);
+    for (size_t i = 0; i < kWordsPerBlock; i++)
+      if (!(block.words[i].load(std::memory_order_relaxed) & Mask(hash, i)))
+        return false;
+    return true;
+  }
+
+  void DedupFilter::Clear() {
+    for (size_t b = 0; b < num_blocks_; b++)
+      for (auto& word : blocks_[b].words)
+        word.store(0, std::memory_order_relaxed);
+    num_inserted_.store(0, std::memory_order_relaxed);
+  }
+
+}  // namespace trooper
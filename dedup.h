@@ -0,0 +1,81 @@
+#ifndef THIRD_PARTY_TROOPER_DEDUP_H_
+#define THIRD_PARTY_TROOPER_DEDUP_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "defs.h"
+
+namespace trooper {
+
+  // 64-bit hash of `bytes` for deduplication (not cryptographic).
+  // Consumes 32 bytes per round in 4 independent lanes, which the compiler
+  // keeps in vector registers; fast enough to hash every mutant.
+  uint64_t HashBytes(ByteSpan bytes);
+
+  // Approximate set of already executed inputs, by hash: a blocked Bloom
+  // filter of fixed size. Each hash sets one bit in each of the 8 words of
+  // one 64-byte block, so a lookup touches a single cache line.
+  // A seen input is never reported new again (two threads racing on the
+  // same new input may both get "new"); a new input is reported as seen
+  // with a small false positive rate, which grows as the filter fills up:
+  // about 1% at 12 bits per inserted hash. So Insert() clears the filter
+  // once that many new hashes went in, forgetting the old inputs rather
+  // than reporting most new ones as seen.
+  //
+  // This class is thread-safe: any number of threads (e.g. one Mutator
+  // each) may share one filter. Insert() is lock-free.
+  class DedupFilter {
+  public:
+    // A filter of 2^log2_bits bits, log2_bits >= 9.
+    explicit DedupFilter(size_t log2_bits = 24);
+
+    // Adds `hash`. Returns true if it was not in the filter.
+    // Clears the filter after max_inserted() new hashes.
+    bool Insert(uint64_t hash);
+
+    bool Contains(uint64_t hash) const;
+
+    // Removes everything. Not atomic w.r.t. concurrent Insert().
+    void Clear();
+
+    size_t num_bits() const { return num_blocks_ * kBlockBits; }
+    size_t max_inserted() const { return num_bits() / kBitsPerHash; }
+    // Number of times Insert() cleared the filter.
+    size_t num_clears() const { return num_clears_.load(std::memory_order_relaxed); }
+
+  private:
+    static constexpr size_t kWordsPerBlock = 8;
+    static constexpr size_t kBlockBits = kWordsPerBlock * 64;
+    // bits per new hash at which Insert() clears the filter
+    static constexpr size_t kBitsPerHash = 12;
+
+    struct alignas(64) Block {
+      std::atomic<uint64_t> words[kWordsPerBlock];
+    };
+
+    Block& BlockOf(uint64_t hash) const {
+      return blocks_[hash & (num_blocks_ - 1)];
+    }
+    // Bit of word `i` of the block, from the high half of the hash.
+    static uint64_t Mask(uint64_t hash, size_t i) {
+      uint32_t salted = static_cast<uint32_t>(hash >> 32) * kSalts[i];
+      return uint64_t{ 1 } << (salted >> 26);
+    }
+    // Odd multipliers, one per word (as in split block Bloom filters).
+    static constexpr uint32_t kSalts[kWordsPerBlock] = {
+      0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+      0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+    };
+
+    size_t num_blocks_;
+    std::unique_ptr<Block[]> blocks_;
+    std::atomic<size_t> num_inserted_{ 0 };  // new hashes since the last clear
+    std::atomic<size_t> num_clears_{ 0 };
+  };
+
+}  // namespace trooper
+
+#endif  // THIRD_PARTY_TROOPER_DEDUP_H_
@@ -0,0 +1,83 @@
+#include "./dedup.h"
+#include "./mutator.h"
+#include "./knobs.h"
+#include "./defs.h"
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace trooper {
+
+void TestFilter() {
+    DedupFilter filter(16);
+    // every thread inserts the same hashes, each must be new exactly once
+    constexpr uint64_t kNumHashes = 2000;
+    std::vector<std::thread> threads;
+    std::vector<size_t> num_new(4, 0);
+    for (size_t t = 0; t < num_new.size(); t++) {
+        threads.emplace_back([&, t]() {
+            for (uint64_t i = 0; i < kNumHashes; i++) {
+                uint8_t bytes[8];
+                memcpy(bytes, &i, 8);
+                num_new[t] += filter.Insert(HashBytes({ bytes, 8 }));
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    size_t total = 0;
+    for (size_t n : num_new)
+        total += n;
+    std::cout << "filter: " << total << " new of " << kNumHashes
+        << " distinct hashes (racing threads may both see new)" << std::endl;
+}
+
+// many more distinct hashes than the filter holds: it keeps clearing
+// itself, so new hashes are still mostly reported new
+void TestSaturation() {
+    DedupFilter filter(16);
+    const uint64_t num_hashes = 20 * filter.max_inserted();
+    size_t num_seen = 0;
+    for (uint64_t i = 0; i < num_hashes; i++) {
+        uint8_t bytes[8];
+        memcpy(bytes, &i, 8);
+        num_seen += !filter.Insert(HashBytes({ bytes, 8 }));
+    }
+    std::cout << "saturation: " << num_seen << " of " << num_hashes
+        << " new hashes reported seen (" << 100.0 * num_seen / num_hashes
+        << "%), " << filter.num_clears() << " clears" << std::endl;
+}
+
+void TestMutator() {
+    Knobs knobs;
+    DedupFilter filter(20);
+    // small seed, mutants converge quickly
+    std::set<ByteArray> seen;
+    size_t num_dups[2] = { 0, 0 };
+    for (int with_filter = 0; with_filter < 2; with_filter++) {
+        Mutator mutator(1, knobs);
+        mutator.set_max_len(2);
+        if (with_filter)
+            mutator.set_dedup_filter(&filter);
+        seen.clear();
+        for (int i = 0; i < 2000; i++) {
+            ByteArray data = { 'a', 'b' };
+            if (!mutator.Mutate(data))
+                continue;
+            num_dups[with_filter] += !seen.insert(data).second;
+        }
+    }
+    std::cout << "duplicate mutants of a 2-byte seed: " << num_dups[0]
+        << " without filter, " << num_dups[1] << " with" << std::endl;
+}
+
+} // namespace trooper
+
+int main() {
+    trooper::TestFilter();
+    trooper::TestSaturation();
+    trooper::TestMutator();
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "deterministic.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "defs.h"
+#include "mutator.h"
+
+namespace trooper {
+
+  DeterministicStage::DeterministicStage(const Mutator& mutator, Cursor cursor)
+    : mutator_(mutator), cursor_(cursor) {}
+
+  size_t DeterministicStage::Next(uint8_t* data, size_t size, size_t capacity) {
+    size = seed_size_ = Restore(data, size);
+    while (cursor_.step != kDone) {
+      bool applied = Apply(data, size, capacity);
+      Advance(size - (undo_ == kInserted ? undo_len_ : 0));
+      if (applied)
+        return size;
+    }
+    return 0;
+  }
+
+  size_t DeterministicStage::Restore(uint8_t* data, size_t size) {
+    switch (undo_) {
+    case kOverwritten:
+      memcpy(data + undo_pos_, saved_, undo_len_);
+      break;
+    case kInserted:
+      memmove(data + undo_pos_, data + undo_pos_ + undo_len_,
+        size - undo_pos_ - undo_len_);
+      size -= undo_len_;
+      break;
+    case kNothing:
+      break;
+    }
+    undo_ = kNothing;
+    return size;
+  }
+
+  bool DeterministicStage::Apply(uint8_t* data, size_t& size, size_t capacity) {
+    const auto dictionary = mutator_.dictionary();
+    // a cursor taken on another seed may point past the end
+    if ((cursor_.step != kFlipBit && cursor_.pos > size) ||
+      (cursor_.step >= kOverwriteDict && cursor_.arg >= dictionary.size()))
+      return false;
+    switch (cursor_.step) {
+    case kFlipBit: {
+      if (cursor_.pos >= size * 8)
+        return false;
+      size_t pos = cursor_.pos / 8;
+      saved_[0] = data[pos];
+      data[pos] ^= 1 << (cursor_.pos % 8);
+      undo_ = kOverwritten, undo_pos_ = pos, undo_len_ = 1;
+      return true;
+    }
+    case kArith: {
+      if (cursor_.pos >= size)
+        return false;
+      uint8_t old = data[cursor_.pos];
+      uint8_t delta = cursor_.arg < kMaxArith ? cursor_.arg + 1 : -(cursor_.arg - kMaxArith + 1);
+      uint8_t value = old + delta;
+      // a single-bit change was already a bit flip
+      if (std::has_single_bit(static_cast<uint8_t>(old ^ value)))
+        return false;
+      saved_[0] = old;
+      data[cursor_.pos] = value;
+      undo_ = kOverwritten, undo_pos_ = cursor_.pos, undo_len_ = 1;
+      return true;
+    }
+    case kOverwriteDict: {
+      const DictEntry& entry = dictionary[cursor_.arg];
+      if (cursor_.pos + entry.size() > size ||
+        !memcmp(data + cursor_.pos, entry.begin(), entry.size()))
+        return false;
+      memcpy(saved_, data + cursor_.pos, entry.size());
+      memcpy(data + cursor_.pos, entry.begin(), entry.size());
+      undo_ = kOverwritten, undo_pos_ = cursor_.pos, undo_len_ = entry.size();
+      return true;
+    }
+    case kInsertDict: {
+      const DictEntry& entry = dictionary[cursor_.arg];
+      size_t new_size = size + entry.size();
+      if (new_size > std::min(capacity, mutator_.max_len()) ||
+        new_size % mutator_.size_alignment() != 0)
+        return false;
+      memmove(data + cursor_.pos + entry.size(), data + cursor_.pos,
+        size - cursor_.pos);
+      memcpy(data + cursor_.pos, entry.begin(), entry.size());
+      size = new_size;
+      undo_ = kInserted, undo_pos_ = cursor_.pos, undo_len_ = entry.size();
+      return true;
+    }
+    case kDone:
+      break;
+    }
+    return false;
+  }
+
+  void DeterministicStage::Advance(size_t size) {
+    const size_t dict_size = mutator_.dictionary().size();
+    Cursor& c = cursor_;
+    switch (c.step) {
+    case kFlipBit:
+      if (++c.pos >= size * 8)
+        c = { kArith, 0, 0 };
+      break;
+    case kArith:
+      if (++c.arg >= 2 * kMaxArith)
+        c.arg = 0, c.pos++;
+      if (c.pos >= size)
+        c = { kOverwriteDict, 0, 0 };
+      break;
+    case kOverwriteDict:
+      if (++c.arg >= dict_size)
+        c.arg = 0, c.pos++;
+      if (c.pos >= size)
+        c = { kInsertDict, 0, 0 };
+      break;
+    case kInsertDict:
+      if (++c.arg >= dict_size)
+        c.arg = 0, c.pos++;
+      // N+1 positions to insert into an array of N
+      if (c.pos > size)
+        c = { kDone, 0, 0 };
+      break;
+    case kDone:
+      break;
+    }
+    // steps with nothing to walk, e.g. an empty dictionary or seed
+    if ((c.step == kFlipBit || c.step == kArith || c.step == kOverwriteDict) && !size)
+      c = { kInsertDict, 0, 0 };
+    if ((c.step == kOverwriteDict || c.step == kInsertDict) && !dict_size)
+      c = { kDone, 0, 0 };
+  }
+
+}  // namespace trooper
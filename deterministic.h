@@ -0,0 +1,98 @@
+#ifndef THIRD_PARTY_TROOPER_DETERMINISTIC_H_
+#define THIRD_PARTY_TROOPER_DETERMINISTIC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "defs.h"
+#include "mutator.h"
+
+namespace trooper {
+
+  // Deterministic mutation stage: walks cheap single-site mutations over
+  // every offset of a seed, in a fixed order and without RNG, so shallow
+  // single-byte dependencies are found in a bounded number of executions:
+  //   1. walking bit flips,
+  //   2. 8-bit arithmetic, +/- 1..kMaxArith on every byte,
+  //   3. overwrite with every dictionary entry at every offset,
+  //   4. insertion of every dictionary entry at every position.
+  // Mutants that an earlier step already produced (e.g. +1 on an even byte
+  // is a bit flip) or that leave the seed unchanged are skipped.
+  //
+  // The stage is a lazy generator: Next() turns the buffer into the next
+  // mutant in place, undoing the previous one first, so no mutant list is
+  // materialised. Its position is a Cursor that can be saved and resumed,
+  // so it can be interleaved with the random Mutator::Mutate() path:
+  //   DeterministicStage stage(mutator, saved_cursor);
+  //   for (size_t n = 0; n < budget; n++) {
+  //     size_t mutant_size = stage.Next(buf, size, cap);
+  //     if (!mutant_size) break;
+  //     Execute(buf, size = mutant_size);
+  //   }
+  //   size = stage.Restore(buf, size);  // back to the seed
+  //   saved_cursor = stage.cursor();
+  //
+  // This class is thread-compatible.
+  class DeterministicStage {
+  public:
+    static constexpr uint32_t kMaxArith = 35;
+
+    enum Step : uint8_t {
+      kFlipBit,
+      kArith,
+      kOverwriteDict,
+      kInsertDict,
+      kDone,
+    };
+
+    // The next mutant to try: `pos` is a bit index for kFlipBit, else a
+    // byte offset; `arg` is the delta index or the dictionary index.
+    struct Cursor {
+      Step step = kFlipBit;
+      uint32_t pos = 0;
+      uint32_t arg = 0;
+    };
+
+    // Uses the dictionary, max length and size alignment of `mutator`,
+    // which must outlive the stage. The cursor is only meaningful for the
+    // seed it was taken on.
+    DeterministicStage(const Mutator& mutator, Cursor cursor);
+    explicit DeterministicStage(const Mutator& mutator)
+      : DeterministicStage(mutator, Cursor{}) {}
+
+    // Restores the previous mutant (if any) to the seed, then applies the
+    // next mutant to `data`. `size` is the current size of `data`, which may
+    // grow up to `capacity`. Returns the new size, or 0 when the stage is
+    // done (`data` then holds the seed, of seed_size() bytes).
+    size_t Next(uint8_t* data, size_t size, size_t capacity);
+
+    // Undoes the last mutant, returns the size of the seed. Call before
+    // `data` is used for anything else, e.g. the random mutators.
+    size_t Restore(uint8_t* data, size_t size);
+
+    Cursor cursor() const { return cursor_; }
+    bool done() const { return cursor_.step == kDone; }
+    size_t seed_size() const { return seed_size_; }
+
+  private:
+    // Applies the mutant at cursor_ if it is useful. Returns false to skip.
+    bool Apply(uint8_t* data, size_t& size, size_t capacity);
+
+    // Moves cursor_ to the next mutant of a seed of `size` bytes.
+    void Advance(size_t size);
+
+    const Mutator& mutator_;
+    Cursor cursor_;
+    size_t seed_size_ = 0;
+
+    // undo record of the applied mutant
+    enum UndoKind : uint8_t { kNothing, kOverwritten, kInserted };
+    UndoKind undo_ = kNothing;
+    size_t undo_pos_ = 0;
+    size_t undo_len_ = 0;
+    uint8_t saved_[DictEntry::kMaxEntrySize];
+  };
+
+}  // namespace trooper
+
+#endif  // THIRD_PARTY_TROOPER_DETERMINISTIC_H_
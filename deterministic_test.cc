@@ -0,0 +1,49 @@
+#include "./deterministic.h"
+#include "./mutator.h"
+#include "./knobs.h"
+#include "./defs.h"
+#include <cstring>
+#include <iostream>
+
+namespace trooper {
+
+void Test() {
+    Knobs knobs;
+    Mutator mutator(1, knobs);
+
+    const uint8_t seed[4] = { 0, 1, 2, 3 };
+    uint8_t buf[8];
+    memcpy(buf, seed, sizeof(seed));
+    size_t size = sizeof(seed);
+
+    // run the stage in two halves, resuming from the saved cursor
+    size_t count = 0, unchanged = 0;
+    DeterministicStage::Cursor cursor;
+    for (int half = 0; half < 2; half++) {
+        DeterministicStage stage(mutator, cursor);
+        for (size_t n = 0; n < 500; n++) {
+            size_t new_size = stage.Next(buf, size, sizeof(buf));
+            if (!new_size) {
+                size = stage.seed_size();
+                break;
+            }
+            size = new_size;
+            count++;
+            unchanged += size == sizeof(seed) && !memcmp(buf, seed, sizeof(seed));
+        }
+        size = stage.Restore(buf, size);
+        cursor = stage.cursor();
+    }
+    bool restored = size == sizeof(seed) && !memcmp(buf, seed, sizeof(seed));
+    std::cout << "deterministic mutants: " << count
+        << ", unchanged: " << unchanged
+        << ", done: " << (cursor.step == DeterministicStage::kDone)
+        << ", seed restored: " << restored << std::endl;
+}
+
+} // namespace trooper
+
+int main() {
+    trooper::Test();
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ corpus distillation from coverage logs (see covr-log.h):
+   distill [-j threads] <log>... > kept.txt
+ every run of the logs is one corpus entry, named by its tag; runs with the
+ same tag are merged. prints the tags of a minimal subset of entries that
+ keeps all features, preferring small and fast inputs: the cost of an entry
+ is the size of the file named by the tag (if it exists) times the wall time
+ of its run (if profiled).
+*/
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "covr-log.h"
+#include "defs.h"
+#include "distill.h"
+
+namespace trooper {
+
+  int DistillMain(int argc, char** argv) {
+    size_t num_threads = std::thread::hardware_concurrency();
+    // the readers stay open, runs point into their mappings
+    std::vector<std::unique_ptr<CovrLogReader>> readers;
+    std::vector<CovrRun> runs;
+    for (int i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+        num_threads = atoi(argv[++i]);
+        continue;
+      }
+      auto& reader = readers.emplace_back(std::make_unique<CovrLogReader>());
+      if (!reader->Open(argv[i]))
+        return 1;
+      CovrRun run;
+      while (reader->Next(run))
+        runs.push_back(run);
+      if (!reader->ok())
+        fprintf(stderr, "distill: malformed coverage log %s\n", argv[i]);
+    }
+    // decoding the runs is most of the work
+    std::vector<FeatureSet> features = BuildFeatureSets(runs, num_threads);
+
+    std::vector<DistillEntry> entries;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, size_t> name_to_entry;
+    for (size_t r = 0; r < runs.size(); r++) {
+      std::string name(runs[r].tag);
+      auto [it, inserted] = name_to_entry.emplace(name, entries.size());
+      if (!inserted) {
+        entries[it->second].features.Merge(features[r]);
+        continue;
+      }
+      struct stat st;
+      double cost = stat(name.c_str(), &st) == 0 ? st.st_size + 1 : 1;
+      CovrProfile profile;
+      if (DecodeProfile(runs[r].Section(kCovrProfile), profile))
+        cost *= profile.wall_us + 1;
+      entries.push_back({ std::move(features[r]), cost });
+      names.push_back(std::move(name));
+    }
+    std::vector<size_t> kept = Distill(entries, num_threads);
+    for (size_t idx : kept)
+      printf("%s\n", names[idx].c_str());
+    fprintf(stderr, "distill: kept %zu of %zu entries\n", kept.size(), entries.size());
+    return 0;
+  }
+
+}  // namespace trooper
+
+int main(int argc, char** argv) {
+  return trooper::DistillMain(argc, argv);
+}
@@ -0,0 +1,246 @@
+#include "distill.h"
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "covr-log.h"
+#include "defs.h"
+
+namespace trooper {
+
+  FeatureSet::FeatureSet(ByteSpan dense) {
+    for (size_t offset = 0; offset < dense.size(); offset += kBlockBytes) {
+      Block block{};
+      memcpy(block.data(), dense.data() + offset,
+        std::min(kBlockBytes, dense.size() - offset));
+      uint64_t any = 0;
+      for (uint64_t word : block)
+        any |= word;
+      if (!any)
+        continue;
+      for (uint64_t word : block)
+        size_ += std::popcount(word);
+      index_.push_back(offset / kBlockBytes);
+      blocks_.push_back(block);
+    }
+  }
+
+  void FeatureSet::Merge(const FeatureSet& other) {
+    std::vector<uint32_t> index;
+    std::vector<Block> blocks;
+    size_t i = 0, j = 0;
+    while (i < index_.size() || j < other.index_.size()) {
+      if (j == other.index_.size() || (i < index_.size() && index_[i] < other.index_[j])) {
+        index.push_back(index_[i]);
+        blocks.push_back(blocks_[i++]);
+      } else if (i == index_.size() || other.index_[j] < index_[i]) {
+        index.push_back(other.index_[j]);
+        blocks.push_back(other.blocks_[j++]);
+      } else {
+        Block block = blocks_[i++];
+        const Block& theirs = other.blocks_[j++];
+        for (size_t w = 0; w < block.size(); w++)
+          block[w] |= theirs[w];
+        index.push_back(index_[i - 1]);
+        blocks.push_back(block);
+      }
+    }
+    index_ = std::move(index);
+    blocks_ = std::move(blocks);
+    size_ = 0;
+    for (const Block& block : blocks_)
+      for (uint64_t word : block)
+        size_ += std::popcount(word);
+  }
+
+  // The loops over a block have a fixed trip count, so the compiler unrolls
+  // them and vectorizes the and-not/or (and the popcount, where the target
+  // has a vector popcount).
+  size_t FeatureSet::CountNew(std::span<const Block> covered) const {
+    size_t n = 0;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      const Block& mine = blocks_[i];
+      const Block& theirs = covered[index_[i]];
+      for (size_t w = 0; w < mine.size(); w++)
+        n += std::popcount(mine[w] & ~theirs[w]);
+    }
+    return n;
+  }
+
+  void FeatureSet::AddTo(std::span<Block> covered) const {
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      const Block& mine = blocks_[i];
+      Block& theirs = covered[index_[i]];
+      for (size_t w = 0; w < mine.size(); w++)
+        theirs[w] |= mine[w];
+    }
+  }
+
+  namespace {
+
+    // features to re-score before a batch is worth spreading over threads
+    constexpr size_t kMinParallelWork = 1 << 16;
+
+    // Runs `fn(i)` for i in [0, n) on `num_threads` threads (the caller's
+    // included), many times over, without respawning the threads.
+    class ParallelFor {
+    public:
+      explicit ParallelFor(size_t num_threads)
+        : barrier_(std::max<std::ptrdiff_t>(num_threads, 1)) {
+        for (size_t t = 1; t < num_threads; t++)
+          threads_.emplace_back([this]() {
+            while (true) {
+              barrier_.arrive_and_wait();
+              if (done_)
+                return;
+              Work();
+              barrier_.arrive_and_wait();
+            }
+          });
+      }
+
+      ~ParallelFor() {
+        done_ = true;
+        barrier_.arrive_and_wait();
+        for (auto& thread : threads_)
+          thread.join();
+      }
+
+      void Run(size_t n, const std::function<void(size_t)>& fn) {
+        if (threads_.empty() || n < 2) {
+          for (size_t i = 0; i < n; i++)
+            fn(i);
+          return;
+        }
+        n_ = n;
+        fn_ = &fn;
+        next_ = 0;
+        barrier_.arrive_and_wait();
+        Work();
+        barrier_.arrive_and_wait();
+      }
+
+    private:
+      void Work() {
+        for (size_t i; (i = next_.fetch_add(1)) < n_;)
+          (*fn_)(i);
+      }
+
+      std::barrier<> barrier_;
+      std::vector<std::thread> threads_;
+      // written by Run() before the start barrier, read after it
+      size_t n_ = 0;
+      const std::function<void(size_t)>* fn_ = nullptr;
+      std::atomic<size_t> next_{ 0 };
+      bool done_ = false;
+    };
+
+  }  // namespace
+
+  std::vector<FeatureSet> BuildFeatureSets(std::span<const CovrRun> runs,
+    size_t num_threads) {
+    std::vector<FeatureSet> sets(runs.size());
+    ParallelFor parallel(std::min(std::max<size_t>(num_threads, 1), runs.size()));
+    parallel.Run(runs.size(), [&](size_t i) {
+      ByteArray dense;
+      // a malformed run covers nothing rather than part of its map
+      if (!MergeRun(runs[i], dense)) {
+        fprintf(stderr, "malformed coverage run %.*s\n",
+          static_cast<int>(runs[i].tag.size()), runs[i].tag.data());
+        return;
+      }
+      sets[i] = FeatureSet(dense);
+    });
+    return sets;
+  }
+
+  std::vector<size_t> Distill(std::span<const DistillEntry> entries,
+    size_t num_threads) {
+    size_t num_blocks = 0;
+    for (const auto& entry : entries)
+      num_blocks = std::max(num_blocks, entry.features.num_blocks());
+    std::vector<FeatureSet::Block> covered(num_blocks, FeatureSet::Block{});
+    std::vector<size_t> result;
+
+    // Candidate ordered by new features per cost, then by lower cost.
+    // `gain` is exact if `round` == result.size(), else an upper bound.
+    struct Candidate {
+      double ratio;
+      size_t gain;
+      size_t idx;
+      size_t round;
+    };
+    auto less = [&](const Candidate& a, const Candidate& b) {
+      if (a.ratio != b.ratio)
+        return a.ratio < b.ratio;
+      if (entries[a.idx].cost != entries[b.idx].cost)
+        return entries[a.idx].cost > entries[b.idx].cost;
+      return a.idx > b.idx;
+    };
+    auto ratio = [&](size_t gain, size_t idx) {
+      return gain / std::max(entries[idx].cost, 1e-9);
+    };
+
+    // with nothing covered yet, the gains are the feature counts
+    std::vector<Candidate> initial;
+    for (size_t i = 0; i < entries.size(); i++) {
+      size_t gain = entries[i].features.size();
+      if (gain)
+        initial.push_back({ ratio(gain, i), gain, i, 0 });
+    }
+    std::priority_queue<Candidate, std::vector<Candidate>, decltype(less)> queue(
+      less, std::move(initial));
+
+    // Lazy greedy: gains only shrink as coverage grows, so an exact top
+    // candidate beats the upper bounds of all others and is taken. Stale
+    // candidates are re-scored a batch from the top at a time, in parallel.
+    num_threads = std::max<size_t>(num_threads, 1);
+    const size_t batch_size = num_threads == 1 ? 1 : 8 * num_threads;
+    ParallelFor parallel(std::min(num_threads, entries.size()));
+    std::vector<Candidate> batch;
+    while (!queue.empty()) {
+      if (queue.top().round == result.size()) {
+        entries[queue.top().idx].features.AddTo(covered);
+        result.push_back(queue.top().idx);
+        queue.pop();
+        continue;
+      }
+      batch.clear();
+      while (!queue.empty() && batch.size() < batch_size &&
+        queue.top().round != result.size()) {
+        batch.push_back(queue.top());
+        queue.pop();
+      }
+      auto rescore = [&](size_t i) {
+        size_t idx = batch[i].idx;
+        size_t gain = entries[idx].features.CountNew(covered);
+        batch[i] = { ratio(gain, idx), gain, idx, result.size() };
+      };
+      // waking the threads costs more than re-scoring a few small entries
+      size_t work = 0;
+      for (const Candidate& candidate : batch)
+        work += entries[candidate.idx].features.size();
+      if (work < kMinParallelWork) {
+        for (size_t i = 0; i < batch.size(); i++)
+          rescore(i);
+      } else {
+        parallel.Run(batch.size(), rescore);
+      }
+      for (const Candidate& candidate : batch)
+        if (candidate.gain)
+          queue.push(candidate);
+    }
+    return result;
+  }
+
+}  // namespace trooper
@@ -0,0 +1,68 @@
+#ifndef THIRD_PARTY_TROOPER_DISTILL_H_
+#define THIRD_PARTY_TROOPER_DISTILL_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "covr-log.h"
+#include "defs.h"
+
+namespace trooper {
+
+  // Features of one corpus entry: the non-zero 64-byte blocks of its dense
+  // coverage map (one byte of bucket bits per guard, see MergeRun()).
+  // Blocks keep set operations SIMD friendly while staying sparse.
+  class FeatureSet {
+  public:
+    static constexpr size_t kBlockBytes = 64;
+    using Block = std::array<uint64_t, kBlockBytes / 8>;
+
+    FeatureSet() = default;
+    explicit FeatureSet(ByteSpan dense);
+
+    // *this |= other
+    void Merge(const FeatureSet& other);
+
+    // number of features, i.e. set bits
+    size_t size() const { return size_; }
+
+    // number of features not in `covered`
+    size_t CountNew(std::span<const Block> covered) const;
+
+    // covered |= *this, `covered` must have at least num_blocks() blocks.
+    void AddTo(std::span<Block> covered) const;
+
+    // one past the highest non-zero block index
+    size_t num_blocks() const { return index_.empty() ? 0 : index_.back() + 1; }
+
+  private:
+    std::vector<uint32_t> index_;  // ascending block indices
+    std::vector<Block> blocks_;
+    size_t size_ = 0;
+  };
+
+  // One corpus entry to distill.
+  struct DistillEntry {
+    FeatureSet features;
+    // e.g. size or execution time; smaller entries are preferred.
+    double cost = 1;
+  };
+
+  // Decodes the edges of each run into a FeatureSet, on `num_threads`
+  // threads.
+  std::vector<FeatureSet> BuildFeatureSets(std::span<const CovrRun> runs,
+    size_t num_threads);
+
+  // Corpus distillation: returns the indices of a subset of `entries` that
+  // keeps the union of all their features, chosen by greedy weighted set
+  // cover (the most new features per cost first, lazily re-evaluated).
+  // Stale gains are re-evaluated in batches on `num_threads` threads.
+  std::vector<size_t> Distill(std::span<const DistillEntry> entries,
+    size_t num_threads);
+
+}  // namespace trooper
+
+#endif  // THIRD_PARTY_TROOPER_DISTILL_H_
@@ -0,0 +1,61 @@
+#include "./distill.h"
+#include "./defs.h"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace trooper {
+
+void Test() {
+    // 4 entries over a 256-guard map:
+    // 0 covers guards [0, 100), 1 covers [0, 10), 2 covers [90, 200),
+    // 3 covers [150, 256) but is expensive, 4 covers [195, 256)
+    auto make = [](size_t begin, size_t end, double cost) {
+        ByteArray dense(256, 0);
+        for (size_t i = begin; i < end; i++)
+            dense[i] = 1;
+        return DistillEntry{ FeatureSet(dense), cost };
+    };
+    std::vector<DistillEntry> entries = {
+        make(0, 100, 1), make(0, 10, 1), make(90, 200, 1),
+        make(150, 256, 100), make(195, 256, 1),
+    };
+    std::vector<size_t> kept = Distill(entries, 2);
+    // expect 2 0 4: 2 has the most features, 3 is too expensive
+    std::cout << "kept entries: ";
+    for (size_t idx : kept)
+        std::cout << idx << " ";
+    std::cout << std::endl;
+}
+
+// the batched parallel re-scoring must pick the same entries as serial
+void TestParallel() {
+    std::mt19937_64 rng(1);
+    std::vector<DistillEntry> entries;
+    for (int i = 0; i < 5000; i++) {
+        ByteArray dense(1 << 14, 0);
+        for (int j = 0; j < 2000; j++)
+            dense[rng() % dense.size()] = 1 << (rng() % 8);
+        entries.push_back({ FeatureSet(dense), double(rng() % 100 + 1) });
+    }
+    for (size_t num_threads : { 1, 8 }) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<size_t> kept = Distill(entries, num_threads);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        size_t sum = 0;
+        for (size_t idx : kept)
+            sum = sum * 31 + idx;
+        std::cout << num_threads << " threads: kept " << kept.size()
+            << " (checksum " << sum << ") in " << ms << "ms" << std::endl;
+    }
+}
+
+} // namespace trooper
+
+int main() {
+    trooper::Test();
+    trooper::TestParallel();
+    return 0;
+}
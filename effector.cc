@@ -0,0 +1,61 @@
+#include "effector.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace trooper {
+
+  EffectorMap::EffectorMap(size_t size)
+    : weights_(size, kInitWeight), tree_(size + 1, 0) {
+    // O(n) construction: push every node into its parent
+    for (size_t i = 1; i <= size; i++) {
+      tree_[i] += kInitWeight;
+      size_t parent = i + (i & -i);
+      if (parent <= size)
+        tree_[parent] += tree_[i];
+    }
+  }
+
+  void EffectorMap::Set(size_t pos, uint32_t weight) {
+    weight = std::clamp(weight, kMinWeight, kMaxWeight);
+    uint64_t delta = static_cast<uint64_t>(weight) - weights_[pos];  // mod 2^64
+    weights_[pos] = weight;
+    for (size_t i = pos + 1; i < tree_.size(); i += i & -i)
+      tree_[i] += delta;
+  }
+
+  uint64_t EffectorMap::PrefixSum(size_t limit) const {
+    uint64_t sum = 0;
+    for (size_t i = limit; i > 0; i -= i & -i)
+      sum += tree_[i];
+    return sum;
+  }
+
+  size_t EffectorMap::Sample(uint64_t random, size_t limit) const {
+    uint64_t r = random % PrefixSum(limit);
+    // descend the tree: find the first position whose prefix sum exceeds r
+    size_t pos = 0;
+    for (size_t step = std::bit_floor(size()); step; step >>= 1) {
+      if (pos + step < tree_.size() && tree_[pos + step] <= r) {
+        pos += step;
+        r -= tree_[pos];
+      }
+    }
+    return pos;
+  }
+
+  void EffectorMap::Learn(std::span<const size_t> positions, bool new_coverage) {
+    for (size_t pos : positions) {
+      if (pos >= size())
+        continue;
+      if (new_coverage)
+        Set(pos, weights_[pos] + kReward);
+      else if (weights_[pos] > kMinWeight)
+        Set(pos, weights_[pos] - kPenalty);
+    }
+  }
+
+}  // namespace trooper
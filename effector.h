@@ -0,0 +1,58 @@
+#ifndef THIRD_PARTY_TROOPER_EFFECTOR_H_
+#define THIRD_PARTY_TROOPER_EFFECTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace trooper {
+
+  // Byte sensitivity (effector) map of one seed: a weight per position of
+  // the seed, learned from which positions' mutations changed coverage.
+  // Mutator draws positions proportionally to these weights, so mutations
+  // focus on the bytes that affect control flow instead of payload.
+  //
+  // Weights are kept in a Fenwick tree: sampling and updates are O(log n).
+  //
+  // This class is thread-compatible.
+  class EffectorMap {
+  public:
+    // Every position starts with this weight, i.e. uniform sampling.
+    static constexpr uint32_t kInitWeight = 16;
+    static constexpr uint32_t kMinWeight = 1;
+    static constexpr uint32_t kMaxWeight = 1 << 12;
+    // Learn() adds kReward to positions that found new coverage, and
+    // subtracts kPenalty from the others.
+    static constexpr uint32_t kReward = 64;
+    static constexpr uint32_t kPenalty = 1;
+
+    // A map for a seed of `size` bytes.
+    explicit EffectorMap(size_t size);
+
+    size_t size() const { return weights_.size(); }
+
+    uint32_t weight(size_t pos) const { return weights_[pos]; }
+
+    // Sets the weight of `pos`, clamped to [kMinWeight, kMaxWeight].
+    void Set(size_t pos, uint32_t weight);
+
+    // Sum of the weights of positions [0, limit).
+    uint64_t PrefixSum(size_t limit) const;
+
+    // Returns a position in [0, limit) with probability proportional to its
+    // weight. `limit` must be in [1, size()].
+    size_t Sample(uint64_t random, size_t limit) const;
+
+    // Feedback for one executed mutant: `positions` were mutated, and the
+    // mutant did (not) find new coverage.
+    void Learn(std::span<const size_t> positions, bool new_coverage);
+
+  private:
+    std::vector<uint32_t> weights_;
+    std::vector<uint64_t> tree_;  // Fenwick tree, 1-based
+  };
+
+}  // namespace trooper
+
+#endif  // THIRD_PARTY_TROOPER_EFFECTOR_H_
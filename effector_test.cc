@@ -0,0 +1,57 @@
+#include "./effector.h"
+#include "./mutator.h"
+#include "./knobs.h"
+#include "./defs.h"
+#include <array>
+#include <iostream>
+#include <vector>
+
+namespace trooper {
+
+void Test() {
+    // a 16-byte seed where only bytes 3 and 12 matter
+    EffectorMap map(16);
+    for (int i = 0; i < 50; i++) {
+        std::array<size_t, 2> hot = { 3, 12 };
+        std::array<size_t, 2> cold = { 5, 7 };
+        map.Learn(hot, true);
+        map.Learn(cold, false);
+    }
+    std::cout << "weights: ";
+    for (size_t i = 0; i < map.size(); i++)
+        std::cout << map.weight(i) << " ";
+    std::cout << std::endl;
+
+    // test weighted sampling
+    Rng rng(1);
+    std::vector<size_t> counts(map.size(), 0);
+    const size_t N = 100000;
+    for (size_t i = 0; i < N; i++)
+        counts[map.Sample(rng(), map.size())]++;
+    std::cout << "sampled ratio: ";
+    for (size_t i = 0; i < counts.size(); i++)
+        std::cout << static_cast<double>(counts[i]) / N << " ";
+    std::cout << std::endl;
+
+    // test mutator positions follow the map
+    Knobs knobs;
+    Mutator mutator(1, knobs);
+    std::array<uint8_t, 7> knob_values = { 0, 0, 0, 1, 0, 0, 0 }; // change byte
+    knobs.Set(knob_values);
+    mutator.set_effector_map(&map);
+    size_t hits = 0;
+    for (size_t i = 0; i < 1000; i++) {
+        ByteArray data(16, 0);
+        mutator.Mutate(data);
+        for (size_t pos : mutator.mutated_positions())
+            hits += pos == 3 || pos == 12;
+    }
+    std::cout << "change byte hit bytes 3/12: " << hits << "/1000" << std::endl;
+}
+
+} // namespace trooper
+
+int main() {
+    trooper::Test();
+    return 0;
+}
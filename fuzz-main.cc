@@ -0,0 +1,432 @@
+/*
+ in-process fuzzing driver. link a target's LLVMFuzzerTestOneInput, built
+ with -fsanitize-coverage=trace-pc-guard or inline-8bit-counters, with this
+ file and covr-rt (see add_trooper_fuzzer in CMakeLists.txt):
+   <fuzzer> [-runs N] [-max_total_time S] [-max_len N] [-seed N]
+            [-knobs file] [-dedup log2_bits] [-deterministic 0|1]
+            [-value_profile 0|1] [-report S] <corpus file or dir>...
+ loads the corpus, then mutates its inputs in place and runs them. after
+ each call the counters are read straight from covr-rt's map, no file I/O:
+ an input that hits a new feature (edge id, counter bucket, or with
+ -value_profile 1 a comparison's value profile bit) joins the corpus, and
+ is saved to the first corpus dir. prints execs/s and coverage every
+ -report seconds, and saves the input to crash-<hash> if a sanitizer
+ reports it. -value_profile 1 needs a target built with trace-cmp, see
+ add_trooper_fuzzer(... VALUE_PROFILE ...).
+ like libFuzzer, the target gets a copy of the input of its exact size, so
+ ASan catches reads just past its end.
+*/
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "covr-log.h"
+#include "covr-rt.h"
+#include "dedup.h"
+#include "defs.h"
+#include "deterministic.h"
+#include "effector.h"
+#include "knobs.h"
+#include "mutator.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+extern "C" __attribute__((weak)) int LLVMFuzzerInitialize(int* argc, char*** argv);
+// from the sanitizer runtime, if one is linked
+extern "C" __attribute__((weak)) void __sanitizer_set_death_callback(void (*callback)(void));
+
+namespace trooper {
+namespace {
+
+  struct Options {
+    uint64_t runs = 0;            // 0: no limit
+    uint64_t max_total_time = 0;  // seconds, 0: no limit
+    size_t max_len = 4096;
+    uint64_t seed = 0;            // 0: from the clock
+    const char* knobs = nullptr;  // raw knob values, see docs/knobs.md
+    size_t dedup = 22;            // log2 bits of the dedup filter, 0: off
+    bool deterministic = true;
+    bool value_profile = false;   // needs -fsanitize-coverage=trace-cmp
+    uint64_t report = 2;          // seconds between status lines
+    std::vector<std::string> corpus;
+  };
+
+  // One corpus entry and what was learned about it.
+  struct Entry {
+    explicit Entry(ByteArray bytes)
+      : data(std::move(bytes)), effector(data.size()) {}
+
+    ByteArray data;
+    EffectorMap effector;
+    DeterministicStage::Cursor cursor;  // progress of the deterministic stage
+  };
+
+  // Features seen so far: seen_[id] has bit (bucket - 1) set for every
+  // bucket of id hit by any input, as in a merged coverage log.
+  class Coverage {
+  public:
+    // Adds the features of the last run. Returns the number of new ones.
+    size_t Collect() {
+      size_t num_modules = trooper_covr_modules(nullptr, 0);
+      if (num_modules != modules_.size()) {
+        // a module was dlopen'd
+        modules_.resize(num_modules);
+        trooper_covr_modules(modules_.data(), num_modules);
+        const auto& last = modules_.back();
+        seen_.resize(last.first_id + last.size, 0);
+      }
+      size_t num_new = 0;
+      for (const auto& m : modules_) {
+        for (size_t i = 0; i < m.size; i++) {
+          // skip zero words, most of the map is zero
+          if (i % 8 == 0 && i + 8 <= m.size) {
+            uint64_t word;
+            memcpy(&word, m.counters + i, 8);
+            if (!word) {
+              i += 7;
+              continue;
+            }
+          }
+          if (!m.counters[i])
+            continue;
+          uint8_t bit = 1 << (CounterToBucket(m.counters[i]) - 1);
+          uint8_t& seen = seen_[m.first_id + i];
+          if (seen & bit)
+            continue;
+          seen |= bit;
+          num_edges_ += !(seen & ~bit);
+          num_features_++;
+          num_new++;
+        }
+      }
+      return num_new + CollectValues();
+    }
+
+    size_t num_edges() const { return num_edges_; }
+    size_t num_features() const { return num_features_; }
+    size_t num_values() const { return num_values_; }
+
+  private:
+    // Adds the value profile bits of the last run, if it is on.
+    size_t CollectValues() {
+      size_t num_bits = 0;
+      const uint64_t* words = trooper_covr_value_profile(&num_bits);
+      if (!words)
+        return 0;
+      seen_values_.resize(num_bits / 64, 0);
+      size_t num_new = 0;
+      for (size_t i = 0; i < seen_values_.size(); i++) {
+        uint64_t new_bits = words[i] & ~seen_values_[i];
+        if (!new_bits)
+          continue;
+        seen_values_[i] |= new_bits;
+        num_new += __builtin_popcountll(new_bits);
+      }
+      num_values_ += num_new;
+      num_features_ += num_new;
+      return num_new;
+    }
+
+    std::vector<trooper_covr_module> modules_;
+    ByteArray seen_;
+    std::vector<uint64_t> seen_values_;
+    size_t num_edges_ = 0;
+    size_t num_features_ = 0;
+    size_t num_values_ = 0;
+  };
+
+  // The input being run, for the death callback.
+  const uint8_t* current_data = nullptr;
+  size_t current_size = 0;
+
+  bool WriteFile(const std::string& path, ByteSpan bytes) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+      fprintf(stderr, "fuzz: failed to open %s\n", path.c_str());
+      return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return (fclose(f) == 0) && ok;
+  }
+
+  bool ReadFile(const std::string& path, ByteArray& bytes) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+      fprintf(stderr, "fuzz: failed to open %s\n", path.c_str());
+      return false;
+    }
+    bytes.clear();
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+      bytes.insert(bytes.end(), chunk, chunk + n);
+    fclose(f);
+    return true;
+  }
+
+  std::string HashName(ByteSpan bytes) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016" PRIx64, HashBytes(bytes));
+    return name;
+  }
+
+  void SaveCrash() {
+    if (!current_data)
+      return;
+    std::string path = "crash-" + HashName({ current_data, current_size });
+    if (WriteFile(path, { current_data, current_size }))
+      fprintf(stderr, "fuzz: crashing input saved to %s\n", path.c_str());
+  }
+
+  // Appends the files named by `path` (a file, or a dir, not recursive).
+  void LoadCorpus(const std::string& path, std::vector<ByteArray>& inputs) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      fprintf(stderr, "fuzz: no such corpus %s\n", path.c_str());
+      return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+      if (ReadFile(path, inputs.emplace_back()))
+        return;
+      inputs.pop_back();
+      return;
+    }
+    DIR* dir = opendir(path.c_str());
+    if (!dir)
+      return;
+    while (struct dirent* entry = readdir(dir)) {
+      std::string file = path + "/" + entry->d_name;
+      if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        LoadCorpus(file, inputs);
+    }
+    closedir(dir);
+  }
+
+  bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+      const char* arg = argv[i];
+      if (arg[0] != '-') {
+        options.corpus.push_back(arg);
+        continue;
+      }
+      if (i + 1 >= argc) {
+        fprintf(stderr, "fuzz: %s needs a value\n", arg);
+        return false;
+      }
+      const char* value = argv[++i];
+      uint64_t number = strtoull(value, nullptr, 10);
+      if (!strcmp(arg, "-runs"))
+        options.runs = number;
+      else if (!strcmp(arg, "-max_total_time"))
+        options.max_total_time = number;
+      else if (!strcmp(arg, "-max_len"))
+        options.max_len = number ? number : 1;
+      else if (!strcmp(arg, "-seed"))
+        options.seed = number;
+      else if (!strcmp(arg, "-knobs"))
+        options.knobs = value;
+      else if (!strcmp(arg, "-dedup"))
+        options.dedup = number ? std::clamp<size_t>(number, 9, 40) : 0;
+      else if (!strcmp(arg, "-deterministic"))
+        options.deterministic = number != 0;
+      else if (!strcmp(arg, "-value_profile"))
+        options.value_profile = number != 0;
+      else if (!strcmp(arg, "-report"))
+        options.report = number ? number : 1;
+      else {
+        fprintf(stderr, "fuzz: unknown option %s\n", arg);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  class Fuzzer {
+  public:
+    explicit Fuzzer(const Options& options)
+      : options_(options),
+      mutator_(options.seed ? options.seed : Now() | 1, knobs_),
+      buf_(options.max_len) {
+      mutator_.set_max_len(options.max_len);
+      if (options.dedup) {
+        dedup_ = std::make_unique<DedupFilter>(options.dedup);
+        mutator_.set_dedup_filter(dedup_.get());
+      }
+      for (const auto& path : options.corpus) {
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+          output_dir_ = path;
+          break;
+        }
+      }
+    }
+
+    int Run() {
+      if (options_.knobs) {
+        ByteArray values;
+        if (!ReadFile(options_.knobs, values))
+          return 1;
+        knobs_.Set(values);
+      }
+      // also on with env TROOPER_VALUE_PROFILE=1
+      if (options_.value_profile)
+        trooper_covr_set_value_profile(1);
+      start_ = last_report_ = Now();
+      std::vector<ByteArray> inputs;
+      for (const auto& path : options_.corpus)
+        LoadCorpus(path, inputs);
+      // the empty input, so that there is always something to mutate
+      inputs.emplace_back();
+      for (auto& input : inputs) {
+        if (input.size() > options_.max_len)
+          input.resize(options_.max_len);
+        memcpy(buf_.data(), input.data(), input.size());
+        if (Execute(input.size()) || corpus_.empty())
+          corpus_.push_back(std::make_unique<Entry>(std::move(input)));
+      }
+      Report("INITED");
+      while (!Done()) {
+        Entry& entry = *corpus_[mutator_.rng()() % corpus_.size()];
+        size_t size = entry.data.size();
+        memcpy(buf_.data(), entry.data.data(), size);
+        if (options_.deterministic && entry.cursor.step != DeterministicStage::kDone)
+          RunDeterministic(entry, size);
+        else
+          RunRandom(entry, size);
+      }
+      Report("DONE");
+      return 0;
+    }
+
+  private:
+    static constexpr size_t kMutantsPerSeed = 64;
+
+    static uint64_t Now() {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Runs buf_[0, size). Returns true and adds it to the corpus files if
+    // it has new features; the caller adds it to corpus_.
+    bool Execute(size_t size) {
+      // a heap block of exactly `size` bytes: buf_ has max_len, so reads
+      // past the input would not be overflows there
+      std::unique_ptr<uint8_t[]> input(new uint8_t[size]);
+      memcpy(input.get(), buf_.data(), size);
+      current_data = input.get();
+      current_size = size;
+      trooper_covr_new_epoch();
+      LLVMFuzzerTestOneInput(input.get(), size);
+      current_data = nullptr;
+      num_execs_++;
+      if (num_execs_ % 1024 == 0 && Now() - last_report_ >= options_.report * 1000000) {
+        last_report_ = Now();
+        Report("pulse");
+      }
+      if (!coverage_.Collect())
+        return false;
+      if (!output_dir_.empty())
+        WriteFile(output_dir_ + "/" + HashName({ buf_.data(), size }),
+          { buf_.data(), size });
+      return true;
+    }
+
+    void AddToCorpus(size_t size) {
+      corpus_.push_back(std::make_unique<Entry>(
+        ByteArray(buf_.begin(), buf_.begin() + size)));
+      Report("NEW");
+    }
+
+    // A slice of the deterministic stage of `entry`, resumed where the
+    // previous slice stopped.
+    void RunDeterministic(Entry& entry, size_t size) {
+      DeterministicStage stage(mutator_, entry.cursor);
+      for (size_t n = 0; n < kMutantsPerSeed && !Done(); n++) {
+        size_t mutant_size = stage.Next(buf_.data(), size, buf_.size());
+        if (!mutant_size)
+          break;
+        size = mutant_size;
+        if (Execute(size))
+          AddToCorpus(size);
+      }
+      entry.cursor = stage.cursor();
+    }
+
+    // Random mutants of `entry`, guided by its effector map. Stacking is
+    // left to the dedup filter: a mutant already run is mutated further.
+    void RunRandom(Entry& entry, size_t size) {
+      mutator_.set_effector_map(&entry.effector);
+      for (size_t n = 0; n < kMutantsPerSeed && !Done(); n++) {
+        if (n)
+          memcpy(buf_.data(), entry.data.data(), size);
+        size_t mutant_size = mutator_.Mutate(buf_.data(), size, buf_.size());
+        if (!mutant_size)
+          continue;
+        bool found = Execute(mutant_size);
+        entry.effector.Learn(mutator_.mutated_positions(), found);
+        if (found)
+          AddToCorpus(mutant_size);
+      }
+      mutator_.set_effector_map(nullptr);
+    }
+
+    bool Done() const {
+      if (options_.runs && num_execs_ >= options_.runs)
+        return true;
+      return options_.max_total_time &&
+        Now() - start_ >= options_.max_total_time * 1000000;
+    }
+
+    void Report(const char* what) const {
+      double seconds = (Now() - start_) / 1e6;
+      fprintf(stderr, "#%" PRIu64 "\t%s cov: %zu ft: %zu vp: %zu corp: %zu"
+        " exec/s: %.0f time: %.1fs\n",
+        num_execs_, what, coverage_.num_edges(), coverage_.num_features(),
+        coverage_.num_values(), corpus_.size(),
+        seconds > 0 ? num_execs_ / seconds : 0.0, seconds);
+    }
+
+    const Options& options_;
+    Knobs knobs_;
+    Mutator mutator_;
+    std::unique_ptr<DedupFilter> dedup_;
+    // entries are referenced while new ones are added
+    std::vector<std::unique_ptr<Entry>> corpus_;
+    Coverage coverage_;
+    ByteArray buf_;  // the input being mutated and run, max_len bytes
+    std::string output_dir_;
+    uint64_t num_execs_ = 0;
+    uint64_t start_ = 0;
+    uint64_t last_report_ = 0;
+  };
+
+  int FuzzMain(int argc, char** argv) {
+    if (LLVMFuzzerInitialize)
+      LLVMFuzzerInitialize(&argc, &argv);
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+      return 1;
+    // the counters are read in-process, leave no logs behind
+    trooper_covr_set_exit_dump(0);
+    if (__sanitizer_set_death_callback)
+      __sanitizer_set_death_callback(SaveCrash);
+    Fuzzer fuzzer(options);
+    return fuzzer.Run();
+  }
+
+}  // namespace
+}  // namespace trooper
+
+int main(int argc, char** argv) {
+  return trooper::FuzzMain(argc, argv);
+}
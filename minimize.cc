@@ -0,0 +1,153 @@
+#include "minimize.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "dedup.h"
+#include "defs.h"
+#include "mutator.h"
+
+namespace trooper {
+
+  Minimizer::Executor Minimizer::ThreadExecutor(Predicate predicate,
+    size_t num_threads) {
+    num_threads = std::max<size_t>(num_threads, 1);
+    return [predicate, num_threads](std::span<const ByteArray> candidates,
+      std::span<uint8_t> results) {
+      std::atomic<size_t> next{ 0 };
+      auto work = [&]() {
+        for (size_t i; (i = next.fetch_add(1)) < candidates.size();)
+          results[i] = predicate(candidates[i]);
+      };
+      std::vector<std::thread> threads;
+      size_t n = std::min(num_threads, candidates.size());
+      for (size_t t = 1; t < n; t++)
+        threads.emplace_back(work);
+      work();
+      for (auto& thread : threads)
+        thread.join();
+    };
+  }
+
+  Minimizer::Minimizer(const Mutator& mutator, Executor executor,
+    size_t batch_size)
+    : size_alignment_(mutator.size_alignment()), executor_(std::move(executor)),
+    batch_size_(std::max<size_t>(batch_size, 1)) {}
+
+  ByteArray Minimizer::Minimize(ByteSpan input) {
+    ByteArray current(input.begin(), input.end());
+    if (FirstPassing({ current }) != 0) {
+      fprintf(stderr, "Minimizer: input does not satisfy the predicate\n");
+      return current;
+    }
+    RemoveChunks(current);
+    SimplifyBytes(current);
+    return current;
+  }
+
+  Minimizer::CacheKey Minimizer::KeyOf(ByteSpan candidate) {
+    return { HashBytes(candidate), candidate.size() };
+  }
+
+  size_t Minimizer::FirstPassing(const std::vector<ByteArray>& candidates) {
+    std::vector<ByteArray> to_run;
+    std::vector<size_t> to_run_idx;
+    // candidates after a cached pass are irrelevant
+    size_t first = candidates.size();
+    for (size_t i = 0; i < candidates.size(); i++) {
+      auto it = cache_.find(KeyOf(candidates[i]));
+      if (it == cache_.end()) {
+        to_run.push_back(candidates[i]);
+        to_run_idx.push_back(i);
+        continue;
+      }
+      num_cache_hits_++;
+      if (it->second) {
+        first = i;
+        break;
+      }
+    }
+    std::vector<uint8_t> results(to_run.size(), 0);
+    if (!to_run.empty())
+      executor_(to_run, results);
+    num_executions_ += to_run.size();
+    for (size_t j = 0; j < to_run.size(); j++) {
+      cache_.emplace(KeyOf(to_run[j]), results[j] != 0);
+      if (results[j] && to_run_idx[j] < first)
+        first = to_run_idx[j];
+    }
+    return first;
+  }
+
+  bool Minimizer::RemoveChunks(ByteArray& input) {
+    bool reduced = false;
+    size_t num_chunks = 2;
+    while (true) {
+      // remove whole aligned units only, so aligned inputs stay aligned
+      size_t units = input.size() / size_alignment_;
+      if (units < 2)
+        break;
+      num_chunks = std::min(num_chunks, units);
+      size_t chunk = (units + num_chunks - 1) / num_chunks * size_alignment_;
+      bool removed = false;
+      for (size_t begin = 0; begin < num_chunks && !removed; begin += batch_size_) {
+        std::vector<ByteArray> candidates;
+        for (size_t i = begin; i < std::min(num_chunks, begin + batch_size_); i++) {
+          size_t from = i * chunk;
+          if (from >= input.size())
+            break;
+          size_t to = std::min(from + chunk, input.size());
+          ByteArray candidate;
+          candidate.reserve(input.size() - (to - from));
+          candidate.insert(candidate.end(), input.begin(), input.begin() + from);
+          candidate.insert(candidate.end(), input.begin() + to, input.end());
+          // never produce the empty input
+          if (!candidate.empty())
+            candidates.push_back(std::move(candidate));
+        }
+        size_t first = FirstPassing(candidates);
+        if (first < candidates.size()) {
+          input = std::move(candidates[first]);
+          num_chunks = std::max<size_t>(num_chunks - 1, 2);
+          removed = reduced = true;
+        }
+      }
+      if (!removed) {
+        if (num_chunks >= units)
+          break;
+        num_chunks = std::min(num_chunks * 2, units);
+      }
+    }
+    return reduced;
+  }
+
+  bool Minimizer::SimplifyBytes(ByteArray& input) {
+    bool simplified = false;
+    size_t pos = 0;
+    while (pos < input.size()) {
+      std::vector<ByteArray> candidates;
+      std::vector<size_t> positions;
+      for (; pos < input.size() && candidates.size() < batch_size_; pos++) {
+        if (input[pos] == kSimpleByte)
+          continue;
+        candidates.push_back(input);
+        candidates.back()[pos] = kSimpleByte;
+        positions.push_back(pos);
+      }
+      size_t first = FirstPassing(candidates);
+      if (first < candidates.size()) {
+        // later candidates were built from the old input, retry them
+        input = std::move(candidates[first]);
+        pos = positions[first] + 1;
+        simplified = true;
+      }
+    }
+    return simplified;
+  }
+
+}  // namespace trooper
@@ -0,0 +1,89 @@
+#ifndef THIRD_PARTY_TROOPER_MINIMIZE_H_
+#define THIRD_PARTY_TROOPER_MINIMIZE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "defs.h"
+#include "mutator.h"
+
+namespace trooper {
+
+  // Shrinks an input while a predicate (e.g. "still crashes the same way")
+  // stays true: delta debugging (ddmin) chunk removal, with chunks aligned
+  // to the mutator's size alignment, then byte simplification.
+  //
+  // Candidates are evaluated in batches through a caller-provided executor,
+  // which may run them in parallel, and every result is cached so no
+  // candidate is evaluated twice. The cache keys on a 64-bit hash and the
+  // size of each candidate, not its bytes, so its memory stays linear in
+  // the number of evaluations; a collision (odds about 2^-64 per pair of
+  // candidates of one size) would reuse the result of another candidate.
+  //
+  // This class is thread-compatible.
+  class Minimizer {
+  public:
+    // Returns true iff `input` still has the property to preserve.
+    using Predicate = std::function<bool(ByteSpan input)>;
+
+    // Sets results[i] to predicate(candidates[i]) for every candidate.
+    // Candidates of one call are independent and may run in parallel.
+    using Executor = std::function<void(std::span<const ByteArray> candidates,
+      std::span<uint8_t> results)>;
+
+    // Executor that runs `predicate` on up to `num_threads` threads.
+    // `predicate` must be thread-safe.
+    static Executor ThreadExecutor(Predicate predicate, size_t num_threads);
+
+    // Uses the size alignment of `mutator`. `batch_size` is the maximal
+    // number of candidates passed to `executor` at once, typically the
+    // number of cores.
+    Minimizer(const Mutator& mutator, Executor executor, size_t batch_size);
+
+    // Returns the smallest input found that satisfies the predicate.
+    // Returns `input` itself if it does not satisfy the predicate.
+    ByteArray Minimize(ByteSpan input);
+
+    // Number of candidates passed to the executor, and found in the cache.
+    size_t num_executions() const { return num_executions_; }
+    size_t num_cache_hits() const { return num_cache_hits_; }
+
+  private:
+    // ddmin: removes aligned chunks while the predicate holds.
+    // Returns true if `input` was reduced.
+    bool RemoveChunks(ByteArray& input);
+
+    // Replaces bytes with kSimpleByte while the predicate holds.
+    bool SimplifyBytes(ByteArray& input);
+
+    // Evaluates `candidates` (cached results first) and returns the index
+    // of the first one that satisfies the predicate, or candidates.size().
+    size_t FirstPassing(const std::vector<ByteArray>& candidates);
+
+    static constexpr uint8_t kSimpleByte = 0;
+
+    struct CacheKey {
+      uint64_t hash;
+      size_t size;
+      bool operator==(const CacheKey&) const = default;
+    };
+    struct CacheKeyHash {
+      size_t operator()(const CacheKey& key) const { return key.hash; }
+    };
+    static CacheKey KeyOf(ByteSpan candidate);
+
+    size_t size_alignment_;
+    Executor executor_;
+    size_t batch_size_;
+    std::unordered_map<CacheKey, bool, CacheKeyHash> cache_;
+    size_t num_executions_ = 0;
+    size_t num_cache_hits_ = 0;
+  };
+
+}  // namespace trooper
+
+#endif  // THIRD_PARTY_TROOPER_MINIMIZE_H_
@@ -0,0 +1,48 @@
+#include "./minimize.h"
+#include "./mutator.h"
+#include "./knobs.h"
+#include "./defs.h"
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+#include <thread>
+
+namespace trooper {
+
+void Test() {
+    Knobs knobs;
+    Mutator mutator(1, knobs);
+
+    // "crashes" iff the input contains "BUG" followed later by a '!'
+    auto predicate = [](ByteSpan input) {
+        std::string_view str = AsStringView(input);
+        size_t pos = str.find("BUG");
+        return pos != str.npos && str.find('!', pos) != str.npos;
+    };
+    std::string_view crash = "some long payload BUG with noise and then a ! at the end";
+    size_t num_threads = std::max(2u, std::thread::hardware_concurrency());
+    Minimizer minimizer(mutator,
+        Minimizer::ThreadExecutor(predicate, num_threads), num_threads);
+    ByteArray result = minimizer.Minimize(AsByteSpan(crash));
+
+    std::cout << "minimized " << crash.size() << " -> " << result.size() << " bytes: ";
+    for (auto byte : result)
+        std::cout << (byte ? static_cast<char>(byte) : '.');
+    std::cout << std::endl;
+    std::cout << "executions: " << minimizer.num_executions()
+        << ", cache hits: " << minimizer.num_cache_hits() << std::endl;
+
+    // test size alignment: keep 4-byte units
+    mutator.set_size_alignment(4);
+    Minimizer aligned(mutator,
+        Minimizer::ThreadExecutor(predicate, num_threads), num_threads);
+    result = aligned.Minimize(AsByteSpan(crash.substr(0, 56)));
+    std::cout << "aligned to 4: " << result.size() << " bytes" << std::endl;
+}
+
+} // namespace trooper
+
+int main() {
+    trooper::Test();
+    return 0;
+}
@@ -22,77 +22,140 @@ namespace trooper {
   // * decrease size mutate: erase bytes.
   // * increase size mutate: insert bytes, insert from dictionary.
 
+  Mutator::Mutator(uintptr_t seed, Knobs& knobs)
+    : Mutator(seed, knobs, kBuiltinMutators) {}
+
+  Mutator::Mutator(uintptr_t seed, Knobs& knobs,
+    std::span<const MutatorDef> registry)
+    : rng_(seed), knobs_(knobs), registry_(registry) {
+    if (seed == 0 || registry.empty() || !IsSortedBySizeClass(registry))
+      __builtin_trap();
+    for (size_t i = 0; i < registry_.size(); i++) {
+      knob_ids_[i] = knobs_.NewId(registry_[i].name);
+      if (knob_ids_[i] != knob_ids_[0] + i)
+        __builtin_trap();
+    }
+    strat1_ = { knob_ids_.data(), CountUpTo(registry_, SizeClass::kDecrease) };
+    strat2_ = { knob_ids_.data(), CountUpTo(registry_, SizeClass::kKeep) };
+    strat3_ = { knob_ids_.data(), registry_.size() };
+    // some built-in dictionaries
+    set_dictionary();
+  }
+
   bool Mutator::Mutate(ByteArray& data) {
+    size_t size = data.size();
+    // room for the largest growth of one built-in mutation; the vector keeps
+    // its capacity, so this only allocates while the input grows.
+    data.resize(size + kMaxGrowth + size_alignment_);
+    size_t new_size = Mutate(data.data(), size, data.size());
+    data.resize(new_size ? new_size : size);
+    return new_size != 0;
+  }
+
+  size_t Mutator::Mutate(uint8_t* data, size_t size, size_t capacity) {
+    num_mutated_positions_ = 0;
+    if (size > capacity)
+      return 0;
+    MutantBuffer buf(data, size, capacity);
+    if (!MutateOnce(buf))
+      return 0;
+    Dedup(buf);
+    return buf.size();
+  }
+
+  bool Mutator::MutateOnce(MutantBuffer& data) {
+    const size_t size = data.size();
+    // the mutant may grow up to max_len_ and the end of the buffer
+    const size_t limit = std::min(max_len_, data.capacity());
+    std::span<const size_t> strat;
+    if (size > max_len_)
+      // only decrease size mutation is acceptable
+      strat = strat1_;
+    else if (size >= limit)
+      // decrease, and same size mutation
+      strat = strat2_;
+    else
+      // decrease, same, increase size mutation
+      strat = strat3_;
+    // a registry may have no mutator of the acceptable size classes
+    if (strat.empty())
+      return false;
     // Individual mutator may fail to mutate and return false.
     // So we iterate a few times and expect one of the mutations will succeed.
     for (int iter = 0; iter < 15; iter++) {
-      Fn mutator = nullptr;
-      size_t knob_id = knobs_.kNumKnobs; // just an invalid num
-      if (data.size() > max_len_)
-        // only decrease size mutation is acceptable
-        knob_id = knobs_.Choose(strat1_, rng_());
-      else if (data.size() == max_len_)
-        // decrease, and same size mutation
-        knob_id = knobs_.Choose(strat2_, rng_());
-      else
-        // decrease, same, increase size mutation
-        knob_id = knobs_.Choose(strat3_, rng_());
-      mutator = knob_to_mutators_.at(knob_id);
-      if ((this->*mutator)(data))
+      size_t knob_id = knobs_.Choose(strat, rng_());
+      const MutatorDef& mutator = registry_[knob_id - knob_ids_[0]];
+      if (size >= mutator.min_size && mutator.fn(*this, data))
         return true;
     }
     return false;
   }
 
-  bool Mutator::FlipBit(ByteArray& data) {
+  void Mutator::Dedup(MutantBuffer& data) {
+    if (!dedup_filter_)
+      return;
+    // a duplicate is still a valid mutant: give up after a few retries
+    for (size_t i = 0; i < kMaxDedupRetries; i++) {
+      if (dedup_filter_->Insert(HashBytes({ data.data(), data.size() })) ||
+        !MutateOnce(data))
+        return;
+    }
+  }
+
+  bool Mutator::FlipBit(MutantBuffer& data) {
     if (!data.size())
       return false;
-    uintptr_t random = rng_();
-    size_t bit_idx = random % (data.size() * 8);
-    size_t byte_idx = bit_idx / 8;
-    bit_idx %= 8;
+    size_t byte_idx = RandomPos(data.size());
+    size_t bit_idx = rng_() % 8;
     uint8_t mask = 1 << bit_idx;
     data[byte_idx] ^= mask;
     return true;
   }
 
-  bool Mutator::SwapBytes(ByteArray& data) {
+  bool Mutator::SwapBytes(MutantBuffer& data) {
     if (!data.size())
       return false;
-    size_t idx1 = rng_() % data.size();
-    size_t idx2 = rng_() % data.size();
+    size_t idx1 = RandomPos(data.size());
+    size_t idx2 = RandomPos(data.size());
+    // also covers idx1 == idx2
+    if (data[idx1] == data[idx2])
+      return false;
     std::swap(data[idx1], data[idx2]);
     return true;
   }
 
-  bool Mutator::ChangeByte(ByteArray& data) {
+  bool Mutator::ChangeByte(MutantBuffer& data) {
     if (!data.size())
       return false;
-    size_t idx = rng_() % data.size();
-    data[idx] = rng_();
+    size_t idx = RandomPos(data.size());
+    // uniform over the 255 other values
+    data[idx] += rng_() % 255 + 1;
     return true;
   }
 
-  bool Mutator::InsertBytes(ByteArray& data) {
+  bool Mutator::InsertBytes(MutantBuffer& data) {
     // Don't insert too many bytes at once.
     const size_t kMaxInsertSize = 20;
     size_t num_new_bytes = rng_() % kMaxInsertSize + 1;
     num_new_bytes = RoundUpToAdd(data.size(), num_new_bytes);
-    if (num_new_bytes > kMaxInsertSize) {
+    if (num_new_bytes > kMaxInsertSize && num_new_bytes >= size_alignment_) {
       num_new_bytes -= size_alignment_;
     }
+    // alignments above kMaxInsertSize may leave nothing that fits
+    if (num_new_bytes == 0 || num_new_bytes > kMaxInsertSize ||
+      num_new_bytes > data.capacity() - data.size())
+      return false;
     // There are N+1 positions to insert something into an array of N.
-    size_t pos = rng_() % (data.size() + 1);
+    size_t pos = RandomPos(data.size() + 1);
     // Fixed array to avoid memory allocation.
     std::array<uint8_t, kMaxInsertSize> new_bytes;
     for (size_t i = 0; i < num_new_bytes; i++)
       new_bytes[i] = rng_();
-    data.insert(data.begin() + pos, new_bytes.begin(),
-      new_bytes.begin() + num_new_bytes);
+    data.Insert(pos, ByteSpan(new_bytes.data(), num_new_bytes));
     return true;
   }
 
-  bool Mutator::EraseBytes(ByteArray& data) {
+  bool Mutator::EraseBytes(MutantBuffer& data) {
     if (data.size() <= size_alignment_)
       return false;
     // Ok to erase a sizable chunk since small inputs are good (if they
@@ -101,41 +164,112 @@ namespace trooper {
     num_bytes_to_erase = RoundDownToRemove(data.size(), num_bytes_to_erase);
     if (num_bytes_to_erase == 0)
       return false;
-    size_t pos = rng_() % (data.size() - num_bytes_to_erase + 1);
-    data.erase(data.begin() + pos, data.begin() + pos + num_bytes_to_erase);
+    size_t pos = RandomPos(data.size() - num_bytes_to_erase + 1);
+    data.Erase(pos, num_bytes_to_erase);
     return true;
   }
 
-  bool Mutator::OverwriteFromDictionary(ByteArray& data) {
+  bool Mutator::OverwriteFromDictionary(MutantBuffer& data) {
     if (dictionary_.empty())
       return false;
     size_t dict_entry_idx = rng_() % dictionary_.size();
     const auto& dic_entry = dictionary_[dict_entry_idx];
     if (dic_entry.size() > data.size())
       return false;
-    size_t overwrite_pos = rng_() % (data.size() - dic_entry.size() + 1);
+    size_t overwrite_pos = RandomPos(data.size() - dic_entry.size() + 1);
+    if (std::equal(dic_entry.begin(), dic_entry.end(), data.begin() + overwrite_pos))
+      return false;
     std::copy(dic_entry.begin(), dic_entry.end(), data.begin() + overwrite_pos);
     return true;
   }
 
-  bool Mutator::InsertFromDictionary(ByteArray& data) {
+  bool Mutator::InsertFromDictionary(MutantBuffer& data) {
     if (dictionary_.empty())
       return false;
     size_t dict_entry_idx = rng_() % dictionary_.size();
     const auto& dict_entry = dictionary_[dict_entry_idx];
+    // entries are inserted whole: skip those that break max_len, capacity
+    // or the size alignment
+    const size_t new_size = data.size() + dict_entry.size();
+    if (new_size > std::min(max_len_, data.capacity()) ||
+      new_size % size_alignment_ != 0)
+      return false;
     // There are N+1 positions to insert something into an array of N.
-    size_t pos = rng_() % (data.size() + 1);
-    data.insert(data.begin() + pos, dict_entry.begin(), dict_entry.end());
+    size_t pos = RandomPos(data.size() + 1);
+    data.Insert(pos, ByteSpan(dict_entry.begin(), dict_entry.size()));
     return true;
   }
 
+  size_t Mutator::RandomPos(size_t n) {
+    size_t pos;
+    size_t mapped = effector_map_ ? std::min(n, effector_map_->size()) : 0;
+    // positions past the end of the map (the seed grew) are drawn uniformly,
+    // in proportion to their number
+    if (mapped && rng_() % n < mapped)
+      pos = effector_map_->Sample(rng_(), mapped);
+    else
+      pos = rng_() % n;
+    if (num_mutated_positions_ < kMaxTrackedPositions)
+      mutated_positions_[num_mutated_positions_++] = pos;
+    return pos;
+  }
+
   void Mutator::add_dictionary(const ByteArray& entry) {
     dictionary_.emplace_back(entry);
   }
 
   // mutate many --> cross over
   // see https://en.wikipedia.org/wiki/Crossover_(genetic_algorithm)
-  // ...
+  bool Mutator::CrossOver(ByteArray& data, ByteSpan other) {
+    size_t size = data.size();
+    data.resize(size + other.size() + size_alignment_);
+    size_t new_size = CrossOver(data.data(), size, data.size(), other);
+    data.resize(new_size ? new_size : size);
+    return new_size != 0;
+  }
+
+  size_t Mutator::CrossOver(uint8_t* data, size_t size, size_t capacity,
+    ByteSpan other) {
+    num_mutated_positions_ = 0;
+    if (size > capacity)
+      return 0;
+    MutantBuffer buf(data, size, capacity);
+    if (!(rng_() % 2 && CrossOverInsert(buf, other)) &&
+      !CrossOverOverwrite(buf, other))
+      return 0;
+    Dedup(buf);
+    return buf.size();
+  }
+
+  bool Mutator::CrossOverInsert(MutantBuffer& data, ByteSpan other) {
+    if (other.empty())
+      return false;
+    size_t num_new_bytes = rng_() % other.size() + 1;
+    num_new_bytes = RoundUpToAdd(data.size(), num_new_bytes);
+    if (num_new_bytes > other.size() && num_new_bytes >= size_alignment_) {
+      num_new_bytes -= size_alignment_;
+    }
+    if (num_new_bytes == 0 || num_new_bytes > other.size() ||
+      data.size() + num_new_bytes > data.capacity())
+      return false;
+    size_t other_pos = rng_() % (other.size() - num_new_bytes + 1);
+    // There are N+1 positions to insert something into an array of N.
+    size_t pos = RandomPos(data.size() + 1);
+    data.Insert(pos, other.subspan(other_pos, num_new_bytes));
+    return true;
+  }
+
+  bool Mutator::CrossOverOverwrite(MutantBuffer& data, ByteSpan other) {
+    if (!data.size() || other.empty())
+      return false;
+    size_t max_size = std::min(data.size(), other.size());
+    size_t size = rng_() % max_size + 1;
+    size_t other_pos = rng_() % (other.size() - size + 1);
+    size_t pos = RandomPos(data.size() - size + 1);
+    std::copy(other.begin() + other_pos, other.begin() + other_pos + size,
+      data.begin() + pos);
+    return true;
+  }
 
   size_t Mutator::RoundUpToAdd(size_t curr_size, size_t to_add) {
     if (curr_size >= max_len_)
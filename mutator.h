@@ -8,9 +8,12 @@
 #include <array>    // import array
 #include <vector>   // import vector
 #include <span>     // import span
-#include <map>      // import map
+#include <limits>
+#include <string_view>
 
 #include "defs.h"
+#include "dedup.h"
+#include "effector.h"
 #include "knobs.h"
 
 namespace trooper {
@@ -39,7 +42,67 @@ namespace trooper {
     uint8_t size_;  // between kMinEntrySize and kMaxEntrySize.
   };
 
-  // This class allows to mutate a ByteArray in different ways.
+  // A mutant in a caller-owned buffer: bytes [0, size) hold the input,
+  // which mutators may grow in place up to `capacity` bytes.
+  // Never allocates, so it can wrap mmapped or shared-memory buffers.
+  class MutantBuffer {
+  public:
+    MutantBuffer(uint8_t* data, size_t size, size_t capacity)
+      : data_(data), size_(size), capacity_(capacity) {}
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    uint8_t* begin() const { return data_; }
+    uint8_t* end() const { return data_ + size_; }
+    uint8_t& operator[](size_t idx) const { return data_[idx]; }
+
+    // Inserts `bytes` before `pos`. Returns false if they do not fit.
+    bool Insert(size_t pos, ByteSpan bytes) {
+      if (size_ + bytes.size() > capacity_)
+        return false;
+      memmove(data_ + pos + bytes.size(), data_ + pos, size_ - pos);
+      memcpy(data_ + pos, bytes.data(), bytes.size());
+      size_ += bytes.size();
+      return true;
+    }
+
+    // Erases `n` bytes starting at `pos`.
+    void Erase(size_t pos, size_t n) {
+      memmove(data_ + pos, data_ + pos + n, size_ - pos - n);
+      size_ -= n;
+    }
+
+  private:
+    uint8_t* data_;
+    size_t size_;
+    size_t capacity_;
+  };
+
+  class Mutator;
+
+  // Which way a mutator changes the size of its input.
+  // Mutate() only picks kDecrease mutators for inputs longer than max_len,
+  // and no kIncrease mutators for inputs of exactly max_len. If the registry
+  // has none of the acceptable classes, Mutate() fails.
+  enum class SizeClass : uint8_t { kDecrease, kKeep, kIncrease };
+
+  // Static description of a mutator, an entry of a mutator registry.
+  // A registry is a constexpr table of these sorted by `size_class`,
+  // see kBuiltinMutators and MergeMutators() below.
+  struct MutatorDef {
+    // Also used as the name of the mutator's knob.
+    std::string_view name;
+    SizeClass size_class = SizeClass::kKeep;
+    // Precondition: the mutator is only called if data.size() >= min_size.
+    size_t min_size = 0;
+    // Mutates `data` in place and returns true iff a mutation took place.
+    // Must not grow `data` past its capacity.
+    bool (*fn)(Mutator&, MutantBuffer&) = nullptr;
+  };
+
+  // This class allows to mutate a ByteArray (or a caller-owned buffer) in
+  // different ways.
   // All mutations expect and guarantee that `data` remains non-empty
   // since there is only one possible empty input and it's uninteresting.
   //
@@ -47,60 +110,72 @@ namespace trooper {
   // Typical usage is to have one such object per thread.
   class Mutator {
   public:
-    // knob_ids_ is one-one mapping to mutators_
-    // knob_id is not same as its index. (see knob.h)
-    static const size_t kMutatorNums_ = 7;
-
     // CTOR. Initializes the internal RNG with `seed` (`seed` != 0).
     // Keeps a const reference to `knobs` throughout the lifetime. ??
-    Mutator(uintptr_t seed, Knobs& knobs) :
-      rng_(seed), knobs_(knobs),
-      knob_ids_{
-        knobs_.NewId("erase bytes"),
-        knobs_.NewId("flip bit"),
-        knobs_.NewId("swap bytes"),
-        knobs_.NewId("change byte"),
-        knobs_.NewId("overwrite from dict"),
-        knobs_.NewId("insert bytes"),
-        knobs_.NewId("insert from dict"),
-      },
-      knob_to_mutators_{
-        {knob_ids_[0], &Mutator::EraseBytes},
-        {knob_ids_[1], &Mutator::FlipBit},
-        {knob_ids_[2], &Mutator::SwapBytes},
-        {knob_ids_[3], &Mutator::ChangeByte},
-        {knob_ids_[4], &Mutator::OverwriteFromDictionary},
-        {knob_ids_[5], &Mutator::InsertBytes},
-        {knob_ids_[6], &Mutator::InsertFromDictionary},
-      },
-      strat1_(knob_ids_.data(), 1),
-      strat2_(knob_ids_.data(), 5),
-      strat3_(knob_ids_.data(), 7)
-    {
-      if (seed == 0)
-        __builtin_trap();
-      // some built-in dictionaries
-      set_dictionary();
-    }
+    // Uses the built-in mutators, kBuiltinMutators.
+    Mutator(uintptr_t seed, Knobs& knobs);
+
+    // Same, with a custom registry, e.g. built-in and domain mutators merged
+    // with MergeMutators(). `registry` must be sorted by size class and must
+    // outlive the Mutator, typically it is a constexpr global.
+    // Registers one knob per mutator, in registry order; traps if `knobs`
+    // runs out of ids or `registry` is not sorted.
+    Mutator(uintptr_t seed, Knobs& knobs, std::span<const MutatorDef> registry);
 
     // Get to access the Knobs instance.
     // Should not add more knobs into mutator's private knobs.
     Knobs& knobs() { return knobs_; }
 
-    // get knobs' id in this mutator.
-    std::array<size_t, kMutatorNums_> knob_ids() {
-      return knob_ids_;
+    // get knobs' id in this mutator, one per registry entry, in order.
+    std::span<const size_t> knob_ids() const {
+      return { knob_ids_.data(), registry_.size() };
     }
 
+    // The registry of this mutator.
+    std::span<const MutatorDef> registry() const { return registry_; }
+
+    // RNG for mutators defined outside of this class.
+    Rng& rng() { return rng_; }
+
     // add `dict_entries` to an internal dictionary
     void add_dictionary(const ByteArray& entry);
 
+    std::span<const DictEntry> dictionary() const { return dictionary_; }
+
+    // Use the effector map of the seed about to be mutated to weight
+    // mutation positions; nullptr (the default) draws them uniformly.
+    // Keeps a pointer, `map` must outlive its use.
+    void set_effector_map(const EffectorMap* map) { effector_map_ = map; }
+
+    // Skip mutants already in `filter`: Mutate() and CrossOver() add each
+    // mutant to it, and stack up to kMaxDedupRetries more mutations on a
+    // mutant that was already there. nullptr (the default) disables it.
+    // Keeps a pointer, `filter` must outlive its use; it may be shared by
+    // the Mutators of all threads.
+    static constexpr size_t kMaxDedupRetries = 8;
+    void set_dedup_filter(DedupFilter* filter) { dedup_filter_ = filter; }
+
+    // Positions drawn by the last Mutate()/CrossOver() call, up to
+    // kMaxTrackedPositions. Feed them to EffectorMap::Learn() once the
+    // mutant has been executed.
+    static constexpr size_t kMaxTrackedPositions = 8;
+    std::span<const size_t> mutated_positions() const {
+      return { mutated_positions_.data(), num_mutated_positions_ };
+    }
+
+    // Returns a random position in [0, n), n > 0, weighted by the effector
+    // map if one is set. Mutators use it for every position they touch.
+    size_t RandomPos(size_t n);
+
     // Type for a Mutator member-function.
-    // Every mutator function takes a ByteArray& as an input, mutates it in place
-    // and returns true if mutation took place. In some cases mutation may fail
-    // to happen, e.g. if EraseBytes() is called on a 1-byte input.
-    // Fn is test-only public.
-    using Fn = bool (Mutator::*)(ByteArray&);
+    // Every mutator function takes a MutantBuffer& as an input, mutates it in
+    // place and returns true if mutation took place. In some cases mutation may
+    // fail to happen, e.g. if EraseBytes() is called on a 1-byte input.
+    using Fn = bool (Mutator::*)(MutantBuffer&);
+
+    // Mutate(ByteArray&) leaves room for this many new bytes (plus the size
+    // alignment), enough for any built-in mutator.
+    static constexpr size_t kMaxGrowth = 32;
 
     using SizeSpan = std::span<const size_t>;
 
@@ -110,29 +185,46 @@ namespace trooper {
     // Applies some random mutation to data.
     bool Mutate(ByteArray& data);
 
+    // Same, in place in a caller-owned buffer: `data[0, size)` is the input,
+    // which may grow up to `capacity` bytes. Honours max_len and size
+    // alignment like Mutate(ByteArray&), and never allocates.
+    // Returns the new size, or 0 if no mutation took place.
+    size_t Mutate(uint8_t* data, size_t size, size_t capacity);
+
     // Flips a random bit.
-    bool FlipBit(ByteArray& data);
+    bool FlipBit(MutantBuffer& data);
 
-    // Swaps two bytes.
-    bool SwapBytes(ByteArray& data);
+    // Swaps two different bytes.
+    bool SwapBytes(MutantBuffer& data);
 
-    // Changes a random byte to a random value.
-    bool ChangeByte(ByteArray& data);
+    // Changes a random byte to a different random value.
+    bool ChangeByte(MutantBuffer& data);
 
     // Overwrites a random part of `data` with a random dictionary entry.
-    bool OverwriteFromDictionary(ByteArray& data);
+    bool OverwriteFromDictionary(MutantBuffer& data);
 
     // Inserts random bytes.
-    bool InsertBytes(ByteArray& data);
+    bool InsertBytes(MutantBuffer& data);
 
     // Inserts a random dictionary entry at random position.
-    bool InsertFromDictionary(ByteArray& data);
+    bool InsertFromDictionary(MutantBuffer& data);
 
     // Erases random bytes.
-    bool EraseBytes(ByteArray& data);
+    bool EraseBytes(MutantBuffer& data);
+
+    // Cross-over: mixes a random chunk of `other` into `data`, either
+    // inserting it or overwriting a chunk of the same size.
+    bool CrossOver(ByteArray& data, ByteSpan other);
 
-    // cross over mutants
-    // ...
+    // Same, in place in a caller-owned buffer, see Mutate() above.
+    // Returns the new size, or 0 if no mutation took place.
+    size_t CrossOver(uint8_t* data, size_t size, size_t capacity, ByteSpan other);
+
+    // Inserts a random chunk of `other` at a random position of `data`.
+    bool CrossOverInsert(MutantBuffer& data, ByteSpan other);
+
+    // Overwrites a random chunk of `data` with a random chunk of `other`.
+    bool CrossOverOverwrite(MutantBuffer& data, ByteSpan other);
 
     // Set size alignment for mutants with modified sizes. Some mutators do not
     // change input size, but mutators that insert or erase bytes will produce
@@ -160,7 +252,42 @@ namespace trooper {
       return true;
     }
 
+    size_t size_alignment() const { return size_alignment_; }
+    size_t max_len() const { return max_len_; }
+
+    // Given a current size and a number of bytes to add, returns the number of
+    // bytes that should be added for the resulting size to be properly aligned.
+    //
+    // If the original to_add would result in an unaligned input size, we round up
+    // to the next larger aligned size.
+    //
+    // This function respects `max_len_` and will return 0 if curr_size is already
+    // greater than or equal to `max_len_`.
+    size_t RoundUpToAdd(size_t curr_size, size_t to_add);
+
+    // Given a current size and a number of bytes to remove, returns the number
+    // of bytes that should be removed for the resulting size to be property
+    // aligned.
+    //
+    // If the original to_remove would result in an unaligned input size, we
+    // round down to the next smaller aligned size.
+    //
+    // However, we never return a number of bytes to remove that would result in
+    // a 0 size. In this case, the resulting size will be the smaller of
+    // curr_size and size_alignment_.
+    //
+    // This function respects `max_len_` and may return a larger number
+    // necessary to get the mutant's size to below `max_len_`.
+    size_t RoundDownToRemove(size_t curr_size, size_t to_remove);
+
   private:
+    // One step of Mutate(): tries a few randomly chosen mutators.
+    bool MutateOnce(MutantBuffer& data);
+
+    // Adds the mutant to the dedup filter; if it was there, stacks more
+    // mutations on it until it is new or retries run out.
+    void Dedup(MutantBuffer& data);
+
     void set_dictionary() {
       add_dictionary({ 0x00 });
       add_dictionary({ 0xFF });
@@ -212,31 +339,6 @@ namespace trooper {
       add_dictionary({ 0xCD, 0xCD, 0xCD, 0xCD });
     }
 
-    // Given a current size and a number of bytes to add, returns the number of
-    // bytes that should be added for the resulting size to be properly aligned.
-    //
-    // If the original to_add would result in an unaligned input size, we round up
-    // to the next larger aligned size.
-    //
-    // This function respects `max_len_` and will return 0 if curr_size is already
-    // greater than or equal to `max_len_`.
-    size_t RoundUpToAdd(size_t curr_size, size_t to_add);
-
-    // Given a current size and a number of bytes to remove, returns the number
-    // of bytes that should be removed for the resulting size to be property
-    // aligned.
-    //
-    // If the original to_remove would result in an unaligned input size, we
-    // round down to the next smaller aligned size.
-    //
-    // However, we never return a number of bytes to remove that would result in
-    // a 0 size. In this case, the resulting size will be the smaller of
-    // curr_size and size_alignment_.
-    //
-    // This function respects `max_len_` and may return a larger number
-    // necessary to get the mutant's size to below `max_len_`.
-    size_t RoundDownToRemove(size_t curr_size, size_t to_remove);
-
     // Size alignment in bytes to generate mutants.
     //
     // For example, if size_alignment_ is 1, generated mutants can have any
@@ -250,14 +352,82 @@ namespace trooper {
 
     Rng rng_;
     Knobs& knobs_;
-    const std::array<size_t, kMutatorNums_>knob_ids_;
-    const std::map<size_t, Fn> knob_to_mutators_;
-
-    const std::span<const size_t> strat1_; // decrease size
-    const std::span<const size_t> strat2_; // decrease/keep
-    const std::span<const size_t> strat3_; // decrease/keep/increase
+    const std::span<const MutatorDef> registry_;
+    // knob_ids_[i] is the knob of registry_[i]; ids are consecutive, so
+    // dispatch is registry_[knob_id - knob_ids_[0]].
+    std::array<size_t, Knobs::kNumKnobs> knob_ids_{};
+
+    std::span<const size_t> strat1_; // decrease size
+    std::span<const size_t> strat2_; // decrease/keep
+    std::span<const size_t> strat3_; // decrease/keep/increase
     std::vector<DictEntry> dictionary_;
+
+    const EffectorMap* effector_map_ = nullptr;
+    DedupFilter* dedup_filter_ = nullptr;
+    std::array<size_t, kMaxTrackedPositions> mutated_positions_{};
+    size_t num_mutated_positions_ = 0;
   };
+
+  // Adapts a Mutator member-function to MutatorDef::fn.
+  template <Mutator::Fn kFn>
+  bool CallMutator(Mutator& mutator, MutantBuffer& data) {
+    return (mutator.*kFn)(data);
+  }
+
+  // Built-in mutators. The order defines their knob ids (see knobs.md).
+  inline constexpr std::array<MutatorDef, 7> kBuiltinMutators = { {
+    { "erase bytes", SizeClass::kDecrease, 2, CallMutator<&Mutator::EraseBytes> },
+    { "flip bit", SizeClass::kKeep, 1, CallMutator<&Mutator::FlipBit> },
+    { "swap bytes", SizeClass::kKeep, 2, CallMutator<&Mutator::SwapBytes> },
+    { "change byte", SizeClass::kKeep, 1, CallMutator<&Mutator::ChangeByte> },
+    { "overwrite from dict", SizeClass::kKeep, 1,
+      CallMutator<&Mutator::OverwriteFromDictionary> },
+    { "insert bytes", SizeClass::kIncrease, 0, CallMutator<&Mutator::InsertBytes> },
+    { "insert from dict", SizeClass::kIncrease, 0,
+      CallMutator<&Mutator::InsertFromDictionary> },
+  } };
+
+  // Returns true if `registry` is sorted by size class, as Mutator expects.
+  constexpr bool IsSortedBySizeClass(std::span<const MutatorDef> registry) {
+    for (size_t i = 1; i < registry.size(); i++)
+      if (registry[i - 1].size_class > registry[i].size_class)
+        return false;
+    return true;
+  }
+
+  // Number of leading entries of a sorted `registry` with size class
+  // `size_class` or smaller.
+  constexpr size_t CountUpTo(std::span<const MutatorDef> registry,
+    SizeClass size_class) {
+    size_t n = 0;
+    while (n < registry.size() && registry[n].size_class <= size_class)
+      n++;
+    return n;
+  }
+
+  // Merges two registries at compile time, e.g. to add domain mutators:
+  //   constexpr MutatorDef kMine[] = {{"flip sign", SizeClass::kKeep, 4, &FlipSign}};
+  //   constexpr auto kRegistry = MergeMutators(kBuiltinMutators, std::to_array(kMine));
+  //   Mutator mutator(seed, knobs, kRegistry);
+  // The result is stable-sorted by size class.
+  template <size_t N, size_t M>
+  constexpr std::array<MutatorDef, N + M> MergeMutators(
+    const std::array<MutatorDef, N>& a, const std::array<MutatorDef, M>& b) {
+    static_assert(N + M <= Knobs::kNumKnobs, "more mutators than knobs");
+    std::array<MutatorDef, N + M> out{};
+    size_t k = 0;
+    for (auto size_class : { SizeClass::kDecrease, SizeClass::kKeep, SizeClass::kIncrease }) {
+      for (const auto& def : a)
+        if (def.size_class == size_class)
+          out[k++] = def;
+      for (const auto& def : b)
+        if (def.size_class == size_class)
+          out[k++] = def;
+    }
+    return out;
+  }
+
+  static_assert(IsSortedBySizeClass(kBuiltinMutators));
 }  // namespace trooper
 
 #endif  // THIRD_PARTY_TROOPER_MUTATOR_H_
\ No newline at end of file
@@ -1,12 +1,105 @@
 #include "./mutator.h"
 #include "./knobs.h"
 #include "./defs.h"
+#include <algorithm>
 #include <chrono>
 #include <array>
 #include <iostream>
 
 namespace trooper {
 
+// a domain mutator registered without editing Mutator
+bool ReverseBytes(Mutator& mutator, MutantBuffer& data) {
+    (void)mutator;
+    std::reverse(data.begin(), data.end());
+    return true;
+}
+
+constexpr MutatorDef kDomainMutators[] = {
+    { "reverse bytes", SizeClass::kKeep, 2, &ReverseBytes },
+};
+
+constexpr auto kRegistry = MergeMutators(kBuiltinMutators, std::to_array(kDomainMutators));
+
+void TestRegistry() {
+    Knobs my_knobs;
+    Mutator mutator(1, my_knobs, kRegistry);
+    // enable only the domain mutator
+    for (size_t knob_id : mutator.knob_ids())
+        my_knobs.Set(my_knobs.Name(knob_id) == "reverse bytes", knob_id);
+    ByteArray data = { 1, 2, 3, 4 };
+    mutator.Mutate(data);
+    std::cout << "reverse bytes (registry): ";
+    for (auto byte : data) {
+        std::cout << static_cast<int>(byte) << " ";
+    }
+    std::cout << std::endl;
+}
+
+// a registry without kDecrease/kKeep mutators can not mutate a full input
+void TestIncreaseOnly() {
+    static constexpr MutatorDef kIncreaseOnly[] = {
+        { "insert bytes", SizeClass::kIncrease, 0, CallMutator<&Mutator::InsertBytes> },
+    };
+    Knobs my_knobs;
+    Mutator mutator(1, my_knobs, kIncreaseOnly);
+    mutator.set_max_len(8);
+    std::cout << "increase-only registry, mutant sizes:";
+    for (size_t size : { 4, 8, 12 }) {
+        ByteArray data(size, 1);
+        bool mutated = mutator.Mutate(data);
+        std::cout << " " << size << "->" << (mutated ? data.size() : 0);
+    }
+    std::cout << std::endl;
+}
+
+void TestInPlace() {
+    Knobs my_knobs;
+    Mutator mutator(1, my_knobs);
+    mutator.set_size_alignment(4);
+    // a caller-owned buffer, the input may grow up to its end
+    uint8_t buf[16] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    size_t size = 8;
+    for (int i = 0; i < 8; i++) {
+        size_t new_size = mutator.Mutate(buf, size, sizeof(buf));
+        if (new_size)
+            size = new_size;
+    }
+    std::cout << "in-place mutants (aligned to 4, capacity 16): " << size << " bytes: ";
+    for (size_t i = 0; i < size; i++) {
+        std::cout << static_cast<int>(buf[i]) << " ";
+    }
+    std::cout << std::endl;
+}
+
+// every mutator alone, in a buffer larger than max_len
+void TestLimits(size_t max_len, size_t alignment) {
+    Knobs my_knobs;
+    Mutator mutator(1, my_knobs);
+    mutator.set_max_len(max_len);
+    mutator.set_size_alignment(alignment);
+    std::cout << "violations of max_len " << max_len << " / alignment " << alignment
+        << " (capacity 64):";
+    for (size_t knob_id : mutator.knob_ids()) {
+        for (size_t other : mutator.knob_ids())
+            my_knobs.Set(other == knob_id, other);
+        size_t too_long = 0, unaligned = 0;
+        for (int i = 0; i < 1000; i++) {
+            uint8_t buf[64] = { 1, 2, 3, 4 };
+            size_t size = mutator.Mutate(buf, 4, sizeof(buf));
+            ByteArray data = { 1, 2, 3, 4 };
+            mutator.Mutate(data);
+            for (size_t mutant_size : { size, data.size() }) {
+                too_long += mutant_size > max_len;
+                // a mutant of the seed's size may keep its (un)alignment
+                unaligned += mutant_size != 4 && mutant_size % alignment != 0;
+            }
+        }
+        std::cout << " " << my_knobs.Name(knob_id) << ": " << too_long << "/" << unaligned << ",";
+    }
+    std::cout << std::endl;
+}
+
 void Test() {
     // using Unix timestamp as rng seed
     auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
@@ -87,5 +180,11 @@ void Test() {
 
 int main() {
     trooper::Test();
+    trooper::TestRegistry();
+    trooper::TestIncreaseOnly();
+    trooper::TestInPlace();
+    trooper::TestLimits(8, 4);
+    // alignment above the largest random insert, from an unaligned input
+    trooper::TestLimits(32, 32);
     return 0;
 }
@@ -1,56 +1,314 @@
-/* 
+/*
  randomly sleep at indirect function call, like callback of ptr handler
 0. pre-compile to object: `clang -c xx -o xx.o -fsanitize=address -fPIC`
 1. just pass this object to clang in compile-time
 2. pass this object to cmake args: `-DCMAKE_CXX_FLAGS="sleep-rt.o -fsanitize-coverage
 =func,trace-pc-guard,indirect-calls"`
+
+ delay policy, loaded once from `TROOPER_SLEEP_POLICY=<file>`, one site per line:
+   <site> <weight> [budget_ms]     # '#' starts a comment
+ - site: module-relative offset of the call site in hex, optionally prefixed
+   by the module basename, e.g. `0x1a2b` or `libfoo.so+0x1a2b` (same as `%M`).
+ - weight: 0..255, probability (weight/255) of a real nanosleep at this site.
+ - budget_ms: total sleep time allowed at this site, default kDefaultBudgetMs.
+ without a policy file every site is chosen with weight kDefaultWeight, which
+ keeps the old blanket behaviour but bounded by the per-site budget. with a
+ policy file, unlisted sites and sites out of budget only get cheap
+ perturbation: sched_yield() or a short spin.
+
+ the last kNumEvents delays are kept in a ring, and dumped (symbolized) to
+ `TROOPER_SLEEP_LOG` (default `sleep-schedule.<pid>.log`) when a sanitizer
+ reports an error, so the schedule that preceded the report can be replayed
+ as a policy.
 */
 
 #include <sanitizer/coverage_interface.h>
+#include <sanitizer/common_interface_defs.h>
+#include <dlfcn.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <sched.h>
+#include <unistd.h>
 #include <pthread.h>
 
-static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+namespace {
 
-// with -fsanitize-coverage=indirect-calls, run before callee entry
-extern "C" void __sanitizer_cov_trace_pc_indir(void *callee) {
-  pthread_mutex_lock(&lock); // lock PRNG
-  double slp_time = (double)rand() / RAND_MAX;
-  if (slp_time > 0.995) {
-    // get a big sleep time with probability of 0.5%
-    slp_time = 3.0 * ((double)rand() / RAND_MAX);
-  } else {
+enum DelayKind : uint8_t { kNone = 0, kYield, kSpin, kSleep };
+
+constexpr size_t kMaxSites = 4096;       // power of 2, open addressing
+constexpr size_t kMaxProbes = 16;        // probes before a site is dropped
+constexpr size_t kMaxPolicies = 1024;
+constexpr size_t kNumEvents = 1024;      // power of 2, ring buffer
+constexpr uint8_t kDefaultWeight = 255;
+constexpr uint64_t kDefaultBudgetMs = 1000;
+constexpr uint32_t kMaxSpin = 1 << 12;
+
+struct Policy {
+  char module[64];  // empty matches any module
+  uintptr_t offset;
+  uint8_t weight;
+  uint64_t budget_ns;
+};
+
+// an indirect call site, resolved against the policy on its first hit.
+struct Site {
+  uintptr_t pc;       // 0 means empty slot
+  int ready;          // set after weight/budget are resolved
+  uint8_t weight;
+  uint64_t budget_ns;
+  uint64_t slept_ns;  // total nanosleep time spent here
+};
+
+struct Event {
+  uintptr_t pc;
+  uint64_t t_ns;      // monotonic time of the delay
+  uint64_t delay_ns;  // sleep time, or spin iterations
+  uint32_t tid;
+  uint8_t kind;
+};
+
+Policy policies[kMaxPolicies];
+size_t num_policies = 0;
+Site sites[kMaxSites];
+Event events[kNumEvents];
+uint64_t next_event = 0;
+uint64_t dropped_sites = 0;  // hits at sites that found no slot
+pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+// per-thread xorshift, no lock needed on the hot path
+__thread uint64_t rng_state = 0;
+__thread uint32_t cached_tid = 0;
+
+uint64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t Rand() {
+  if (!rng_state)
+    rng_state = (NowNs() ^ ((uint64_t)pthread_self() << 1)) | 1;
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// uniform double in [0, 1)
+double RandUnit() {
+  return (double)(Rand() >> 11) / (double)(1ull << 53);
+}
+
+void LoadPolicy() {
+  const char* path = getenv("TROOPER_SLEEP_POLICY");
+  if (!path)
+    return;
+  FILE* f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "sleep-rt: failed to open policy %s\n", path);
+    return;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f) && num_policies < kMaxPolicies) {
+    char site[128];
+    unsigned weight = 0;
+    unsigned long long budget_ms = kDefaultBudgetMs;
+    if (char* comment = strchr(line, '#'))
+      *comment = '\0';
+    if (sscanf(line, "%127s %u %llu", site, &weight, &budget_ms) < 2)
+      continue;
+    Policy& p = policies[num_policies];
+    // accept `%M` output as is: "(libfoo.so+0x1a2b)"
+    char* name = site[0] == '(' ? site + 1 : site;
+    if (char* paren = strchr(name, ')'))
+      *paren = '\0';
+    const char* off = name;
+    p.module[0] = '\0';
+    if (char* plus = strrchr(name, '+')) {
+      *plus = '\0';
+      snprintf(p.module, sizeof(p.module), "%.*s", int(sizeof(p.module) - 1), name);
+      off = plus + 1;
+    }
+    p.offset = strtoull(off, NULL, 16);
+    p.weight = weight > 255 ? 255 : weight;
+    p.budget_ns = budget_ms * 1000000ull;
+    num_policies++;
+  }
+  fclose(f);
+  fprintf(stderr, "sleep-rt: loaded %zu sites from %s\n", num_policies, path);
+}
+
+// match `pc` against the policy, by module basename and offset.
+void Resolve(Site* s) {
+  s->weight = 0;
+  s->budget_ns = 0;
+  if (!num_policies) {
+    s->weight = kDefaultWeight;
+    s->budget_ns = kDefaultBudgetMs * 1000000ull;
+    return;
+  }
+  Dl_info info;
+  if (!dladdr((void*)s->pc, &info) || !info.dli_fbase)
+    return;
+  uintptr_t offset = s->pc - (uintptr_t)info.dli_fbase;
+  const char* base = info.dli_fname ? strrchr(info.dli_fname, '/') : NULL;
+  base = base ? base + 1 : (info.dli_fname ? info.dli_fname : "");
+  for (size_t i = 0; i < num_policies; i++) {
+    const Policy& p = policies[i];
+    if (p.offset == offset && (!p.module[0] || !strcmp(p.module, base))) {
+      s->weight = p.weight;
+      s->budget_ns = p.budget_ns;
+      return;
+    }
+  }
+}
+
+// find or insert the site of `pc`. returns NULL if it is not usable yet,
+// i.e. another thread is resolving it, or the table is full.
+Site* GetSite(uintptr_t pc) {
+  size_t idx = (pc * 0x9E3779B97F4A7C15ull >> 40) & (kMaxSites - 1);
+  // bounded probing: a full table costs a few loads per hit, not a scan
+  for (size_t n = 0; n < kMaxProbes; n++, idx = (idx + 1) & (kMaxSites - 1)) {
+    Site* s = &sites[idx];
+    uintptr_t cur = __atomic_load_n(&s->pc, __ATOMIC_ACQUIRE);
+    if (cur == 0) {
+      uintptr_t expected = 0;
+      if (__atomic_compare_exchange_n(&s->pc, &expected, pc, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        Resolve(s);
+        __atomic_store_n(&s->ready, 1, __ATOMIC_RELEASE);
+        return s;
+      }
+      cur = expected;
+    }
+    if (cur == pc)
+      return __atomic_load_n(&s->ready, __ATOMIC_ACQUIRE) ? s : NULL;
+  }
+  __atomic_fetch_add(&dropped_sites, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+void Record(uintptr_t pc, uint8_t kind, uint64_t delay) {
+  uint64_t i = __atomic_fetch_add(&next_event, 1, __ATOMIC_RELAXED);
+  Event& e = events[i & (kNumEvents - 1)];
+  e.pc = pc;
+  e.t_ns = NowNs();
+  e.delay_ns = delay;
+  if (!cached_tid)
+    cached_tid = (uint32_t)gettid();
+  e.tid = cached_tid;
+  e.kind = kind;
+}
+
+// sanitizer death callback: dump the delay schedule, oldest first.
+void DumpSchedule() {
+  char fn[256];
+  const char* path = getenv("TROOPER_SLEEP_LOG");
+  if (!path) {
+    snprintf(fn, sizeof(fn), "sleep-schedule.%d.log", (int)getpid());
+    path = fn;
+  }
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "sleep-rt: failed to open %s\n", path);
+    return;
+  }
+  static const char* kKindNames[] = { "none", "yield", "spin", "sleep" };
+  uint64_t end = __atomic_load_n(&next_event, __ATOMIC_ACQUIRE);
+  uint64_t begin = end > kNumEvents ? end - kNumEvents : 0;
+  fprintf(f, "# dropped site hits: %llu\n",
+    (unsigned long long)__atomic_load_n(&dropped_sites, __ATOMIC_RELAXED));
+  fprintf(f, "# t_ns tid kind delay site\n");
+  for (uint64_t i = begin; i < end; i++) {
+    const Event& e = events[i & (kNumEvents - 1)];
+    char pc_descr[1024];
+    __sanitizer_symbolize_pc((void*)e.pc, "%M %F %L", pc_descr, sizeof(pc_descr));
+    fprintf(f, "%llu %u %s %llu %s\n", (unsigned long long)e.t_ns, e.tid,
+      kKindNames[e.kind & 3], (unsigned long long)e.delay_ns, pc_descr);
+  }
+  fclose(f);
+  fprintf(stderr, "sleep-rt: delay schedule written to %s\n", path);
+}
+
+void Init() {
+  LoadPolicy();
+  __sanitizer_set_death_callback(DumpSchedule);
+}
+
+// the old blanket distribution: up to 0.1s, up to 3s with probability 0.5%
+uint64_t SleepTimeNs() {
+  double slp_time = RandUnit();
+  if (slp_time > 0.995)
+    slp_time = 3.0 * RandUnit();
+  else
     slp_time /= 10.0;
+  return (uint64_t)(slp_time * 1e9);
+}
+
+void Perturb(uintptr_t pc) {
+  uint64_t r = Rand();
+  switch (r & 3) {
+  case 0:
+    break;
+  case 1:
+    sched_yield();
+    Record(pc, kYield, 0);
+    break;
+  default: {
+    uint32_t n = (r >> 2) % kMaxSpin;
+    for (uint32_t i = 0; i < n; i++)
+      __asm__ __volatile__("" ::: "memory");
+    Record(pc, kSpin, n);
+  }
   }
-  pthread_mutex_unlock(&lock); //  release lock 
-  
-  int sec = (int)slp_time;
-  int ns = (int)((slp_time - sec) * 1e9);
-  struct timespec req = {sec, ns};
-  nanosleep(&req, NULL); 
-
-  // get symbols
-  void *pc = __builtin_return_address(0);
-  char pc_descr[1024];
-  __sanitizer_symbolize_pc(pc, "%p %F %L", pc_descr, sizeof(pc_descr));
-  fprintf(stderr, "indirect call: %s\n", pc_descr);
+}
+
+} // namespace
 
+// with -fsanitize-coverage=indirect-calls, run before callee entry
+extern "C" void __sanitizer_cov_trace_pc_indir(void *callee) {
+  (void)callee;
+  pthread_once(&init_once, Init);
+  uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+  Site* s = GetSite(pc);
+  if (!s || !s->weight || Rand() % 255 >= s->weight) {
+    Perturb(pc);
+    return;
+  }
+  // reserve the sleep from the budget first, so that threads racing at
+  // the same site can not overshoot it
+  uint64_t want = SleepTimeNs();
+  uint64_t slept = __atomic_load_n(&s->slept_ns, __ATOMIC_RELAXED);
+  uint64_t ns;
+  do {
+    if (slept >= s->budget_ns) {
+      // out of budget, fall back to cheap perturbation
+      Perturb(pc);
+      return;
+    }
+    ns = want < s->budget_ns - slept ? want : s->budget_ns - slept;
+  } while (!__atomic_compare_exchange_n(&s->slept_ns, &slept, slept + ns,
+    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  Record(pc, kSleep, ns);
+  struct timespec req = {(time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull)};
+  nanosleep(&req, NULL);
 }
 
 
 // with -fsan...=trace-pc-guard
 extern "C" void __sanitizer_cov_trace_pc_guard_init(uint32_t * start, uint32_t * stop) {
+  (void)start, (void)stop;
   // asan report path
   __sanitizer_set_report_path("/home/JayWaves/log/asan");
-  // init PRNG
-  srand(time(NULL)); // 使用当前时间作为随机数种子
+  pthread_once(&init_once, Init);
 }
 
-// with -fsan...=func,trace-pc-guard, run after func entry 
+// with -fsan...=func,trace-pc-guard, run after func entry
 extern "C" void __sanitizer_cov_trace_pc_guard(uint32_t * guard) {
-  // do nothing
+  (void)guard;  // do nothing
 }
 
   // the full list of available symbolization placeholders: